@@ -15,6 +15,17 @@
 namespace SPLINTER
 {
 
+/*
+ * Storage layout of a batch of points
+ * COLUMNS: one point per column (numVariables x numPoints)
+ * ROWS: one point per row (numPoints x numVariables)
+ */
+enum class PointLayout
+{
+    COLUMNS,
+    ROWS
+};
+
 /*
  * Interface for approximants
  */
@@ -27,17 +38,32 @@ public:
     /*
      * Returns the spline value at x
      */
-    virtual double eval(DenseVector x) const = 0;
+    virtual double eval(const DenseVector &x) const = 0;
 
     /*
      * Returns the (1 x numVariables) Jacobian evaluated at x
      */
-    virtual DenseMatrix evalJacobian(DenseVector x) const = 0;
+    virtual DenseMatrix evalJacobian(const DenseVector &x) const = 0;
 
     /*
      * Returns the (numVariables x numVariables) Hessian evaluated at x
      */
-    virtual DenseMatrix evalHessian(DenseVector x) const = 0;
+    virtual DenseMatrix evalHessian(const DenseVector &x) const = 0;
+
+    /*
+     * Evaluates the approximant at a batch of points stored in x (see PointLayout).
+     * On return, y(i) holds the value at point i.
+     * The points are split evenly between numThreads threads (0 = one per hardware thread).
+     */
+    void evalBatch(const DenseMatrix &x, DenseVector &y,
+                   PointLayout layout = PointLayout::COLUMNS, unsigned int numThreads = 1) const;
+
+    /*
+     * Evaluates the Jacobian at a batch of points stored in x (see PointLayout).
+     * On return, row i of jacobians (numPoints x numVariables) holds the Jacobian at point i.
+     */
+    void evalJacobianBatch(const DenseMatrix &x, DenseMatrix &jacobians,
+                           PointLayout layout = PointLayout::COLUMNS, unsigned int numThreads = 1) const;
 
     /*
      * Get the dimension
@@ -55,6 +81,32 @@ public:
     * Throws if file could not be opened or if the file format is wrong
     */
     virtual void load(const std::string fileName) = 0;
+
+protected:
+
+    /*
+     * Evaluates the points [begin, end) of a batch.
+     * Called concurrently on disjoint ranges, so implementations must not modify shared state.
+     * The default implementations call eval and evalJacobian once per point;
+     * derived classes override them to reuse workspace between points.
+     */
+    virtual void evalBatchRange(const DenseMatrix &x, PointLayout layout,
+                                unsigned int begin, unsigned int end, DenseVector &y) const;
+    virtual void evalJacobianBatchRange(const DenseMatrix &x, PointLayout layout,
+                                        unsigned int begin, unsigned int end, DenseMatrix &jacobians) const;
+
+    // Copies point i of a batch into xi, which must have numVariables elements
+    static void getBatchPoint(const DenseMatrix &x, PointLayout layout, unsigned int i, DenseVector &xi)
+    {
+        if (layout == PointLayout::COLUMNS)
+            xi = x.col(i);
+        else
+            xi = x.row(i).transpose();
+    }
+
+private:
+
+    unsigned int getNumBatchPoints(const DenseMatrix &x, PointLayout layout) const;
 };
 
 } // namespace SPLINTER
@@ -33,6 +33,9 @@ enum class BSplineType
  */
 class API BSpline : public Approximant
 {
+    friend class BSplineFitter;
+    friend class BSplineView;
+
 public:
 
     /**
@@ -52,15 +55,22 @@ public:
      */
     BSpline(const std::string fileName);
 
+    /**
+     * Construct B-spline that approximates scattered samples (not necessarily on a grid) by
+     * multilevel B-spline approximation. The knots are uniform on the bounding box of the samples,
+     * and the finest level has 2^(numLevels-1) knot intervals in each variable.
+     */
+    static BSpline multilevelApproximation(const DataTable &samples, unsigned int degree, unsigned int numLevels);
+
     virtual BSpline* clone() const { return new BSpline(*this); }
 
     void init();
 
     // Evaluation of B-spline
-    double eval(DenseVector x) const;
+    double eval(const DenseVector &x) const;
 	double eval(double x) const;
-    DenseMatrix evalJacobian(DenseVector x) const;
-    DenseMatrix evalHessian(DenseVector x) const;
+    DenseMatrix evalJacobian(const DenseVector &x) const;
+    DenseMatrix evalHessian(const DenseVector &x) const;
 
     // Getters
     unsigned int getNumVariables() const override { return numVariables; }
@@ -79,6 +89,15 @@ public:
     // B-spline operations
     void reduceDomain(std::vector<double> lb, std::vector<double> ub, bool doRegularizeKnotVectors = true);
 
+    /*
+     * Computes lower and upper bounds on the B-spline over the box [lb, ub] (convex hull property).
+     * The bounds are the extreme coefficients of the basis functions supported on the box, found
+     * without copying. With tight = true, these coefficients are restricted to the box and
+     * decomposed to Bezier form first, which gives tighter bounds at the cost of knot insertion.
+     */
+    void bounds(const std::vector<double> &lb, const std::vector<double> &ub,
+                double &lower, double &upper, bool tight = false) const;
+
     // Perform global knot refinement
     void globalKnotRefinement(); // All knots in one shabang
 
@@ -107,8 +126,11 @@ protected:
     // Control point computations
     void computeKnotAverages();
     virtual void computeControlPoints(const DataTable &samples);
+    virtual bool computeControlPointsKronecker(const DataTable &samples);
+    void computeCollocationMatrices(const DataTable &samples, std::vector<SparseMatrix> &matrices) const;
     void computeBasisFunctionMatrix(const DataTable &samples, SparseMatrix &A) const;
     void controlPointEquationRHS(const DataTable &samples, DenseMatrix &Bx, DenseMatrix &By) const;
+    void computeMultilevelApproximation(const DataTable &samples, unsigned int degree, unsigned int numLevels);
 
 private:
 
@@ -116,8 +138,28 @@ private:
     void regularizeKnotVectors(std::vector<double> &lb, std::vector<double> &ub);
     bool removeUnsupportedBasisFunctions(std::vector<double> &lb, std::vector<double> &ub);
 
+    // Same as a copy followed by reduceDomain, but only the coefficients supported on the box are copied
+    BSpline sliceDomain(const std::vector<double> &lb, const std::vector<double> &ub, bool doRegularizeKnotVectors) const;
+
+    /*
+     * Knot insertion and removal applied to the control points one tensor mode at a time.
+     * A[i] maps the coefficients of variable i (new x old), dims holds the old number of basis functions.
+     */
+    void transformControlPoints(const std::vector<SparseMatrix> &A);
+    void transformControlPoints(const SparseMatrix &A, const std::vector<unsigned int> &dims, unsigned int dim);
+
     // Helper functions
-    bool pointInDomain(DenseVector x) const;
+    bool pointInDomain(const DenseVector &x) const;
+
+    // Contraction of the nonzero basis function values (or derivatives) with the supported coefficients
+    double contractLocal(const LocalBasis &local, const unsigned int *orders, unsigned int dim = 0, unsigned int index = 0) const;
+    void contractLocalJacobian(const LocalBasis &local, double *jacobian, unsigned int stride) const;
+
+    // Batch evaluation kernels (see Approximant)
+    void evalBatchRange(const DenseMatrix &x, PointLayout layout,
+                        unsigned int begin, unsigned int end, DenseVector &y) const override;
+    void evalJacobianBatchRange(const DenseMatrix &x, PointLayout layout,
+                                unsigned int begin, unsigned int end, DenseMatrix &jacobians) const override;
 
     void load(const std::string fileName) override;
     void loadBasis(std::vector<std::vector<double>> knotVectors, std::vector<unsigned int> basisDegrees);
@@ -12,10 +12,31 @@
 
 #include "generaldefinitions.h"
 #include "bsplinebasis1d.h"
+#include "bsplinesimd.h"
 
 namespace SPLINTER
 {
 
+// Size limits of the fixed-size workspace used by the allocation-free evaluation kernels
+const unsigned int MAX_LOCAL_NUM_VARIABLES = 16;
+const unsigned int MAX_LOCAL_DERIVATIVE_ORDER = 2;
+
+/*
+ * The nonzero univariate basis function values (and derivatives) at a point x.
+ * In variable i, basis functions first[i],...,first[i]+size[i]-1 are nonzero,
+ * and values[i][r][k] is the rth derivative of basis function first[i]+k at x(i).
+ * Only derivatives up to order numDerivatives are computed.
+ */
+struct LocalBasis
+{
+    unsigned int numVariables;
+    unsigned int numDerivatives;
+    unsigned int numBasisFunctions[MAX_LOCAL_NUM_VARIABLES];
+    unsigned int first[MAX_LOCAL_NUM_VARIABLES];
+    unsigned int size[MAX_LOCAL_NUM_VARIABLES];
+    double values[MAX_LOCAL_NUM_VARIABLES][MAX_LOCAL_DERIVATIVE_ORDER+1][MAX_LOCAL_DEGREE+1];
+};
+
 class BSplineBasis
 {
 public:
@@ -27,19 +48,27 @@ public:
 
     // Evaluation
     SparseVector eval(const DenseVector &x) const;
-    DenseMatrix evalBasisJacobianOld(DenseVector &x) const; // Depricated
-    SparseMatrix evalBasisJacobian(DenseVector &x) const;
-    SparseMatrix evalBasisJacobian2(DenseVector &x) const; // A bit slower than evaBasisJacobianOld()
-    SparseMatrix evalBasisHessian(DenseVector &x) const;
-
-    // Knot vector manipulation
-    SparseMatrix refineKnots();
-    SparseMatrix refineKnotsLocally(DenseVector x);
-    SparseMatrix decomposeToBezierForm();
+    void evalLocal(const DenseVector &x, LocalBasis &local, unsigned int numDerivatives = 0) const;
+    void expandLocal(const LocalBasis &local, std::vector<unsigned int> &indices, std::vector<double> &values) const;
+    void initSimdBlock(SimdBlock &block) const;
+    void setSimdBlockPoint(SimdBlock &block, unsigned int lane, const DenseVector &x) const;
+    DenseMatrix evalBasisJacobianOld(const DenseVector &x) const; // Depricated
+    SparseMatrix evalBasisJacobian(const DenseVector &x) const;
+    SparseMatrix evalBasisJacobian2(const DenseVector &x) const; // A bit slower than evaBasisJacobianOld()
+    SparseMatrix evalBasisHessian(const DenseVector &x) const;
+
+    /*
+     * Knot vector manipulation. The multivariate knot insertion matrix is the Kronecker product
+     * of the univariate matrices, so these return one matrix per variable (or, for insertKnots,
+     * the matrix of variable dim only). Apply them to the coefficient tensor one mode at a time.
+     */
+    std::vector<SparseMatrix> refineKnots();
+    std::vector<SparseMatrix> refineKnotsLocally(DenseVector x);
+    std::vector<SparseMatrix> decomposeToBezierForm();
     SparseMatrix insertKnots(double tau, unsigned int dim, unsigned int multiplicity = 1);
 
     // Getters
-    BSplineBasis1D getSingleBasis(int dim);
+    BSplineBasis1D getSingleBasis(int dim) const;
     std::vector< std::vector<double> > getKnotVectors() const;
     std::vector<double> getKnotVector(int dim) const;
 
@@ -49,18 +78,27 @@ public:
     unsigned int getNumBasisFunctions(unsigned int dim) const;
     std::vector<unsigned int> getNumBasisFunctionsTarget() const;
 
+    // Setters
+    void setNumBasisFunctionsTarget(unsigned int dim, unsigned int target);
+
     double getKnotValue(int dim, int index) const;
     unsigned int getKnotMultiplicity(unsigned int dim, double tau) const;
     unsigned int getLargestKnotInterval(unsigned int dim) const;
 
     int supportedPrInterval() const;
+    bool fitsLocalBasis() const;
+    bool fitsSimdBlock() const;
 
-    bool insideSupport(DenseVector &x) const;
+    bool insideSupport(const DenseVector &x) const;
     std::vector<double> getSupportLowerBound() const;
     std::vector<double> getSupportUpperBound() const;
 
     // Support related
-    bool reduceSupport(std::vector<double>& lb, std::vector<double>& ub, SparseMatrix &A);
+    // Basis functions first[i],...,last[i] of variable i are nonzero on the box (lb, ub)
+    void indexSupportedBasisfunctions(const std::vector<double> &lb, const std::vector<double> &ub,
+                                      std::vector<unsigned int> &first, std::vector<unsigned int> &last) const;
+    // first[i] is the index (before the update) of the first basis function of variable i that remains
+    bool reduceSupport(std::vector<double>& lb, std::vector<double>& ub, std::vector<unsigned int> &first);
 
 private:
     std::vector<BSplineBasis1D> bases;
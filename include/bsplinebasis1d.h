@@ -15,6 +15,12 @@
 namespace SPLINTER
 {
 
+// Largest degree for which the evaluation kernels keep their workspace on the stack
+const unsigned int MAX_LOCAL_DEGREE = 7;
+
+// Largest degree with a precomputed uniform B-spline basis matrix
+const unsigned int MAX_UNIFORM_DEGREE = 5;
+
 enum class KnotVectorType
 {
     EXPLICIT,   // Knot sequence is explicitly given (it should be regular)
@@ -34,6 +40,10 @@ public:
     SparseVector evaluateDerivative(double x, int r) const;
     SparseVector evaluateFirstDerivative(double x) const; // Depricated
 
+    // Evaluation of the degree+1 nonzero basis functions (and their derivatives) at x (returns the knot span index)
+    int evaluateNonZero(double x, double *values) const;
+    int evaluateNonZeroDerivatives(double x, unsigned int n, double *derivatives, unsigned int stride) const;
+
     // Knot vector related
     SparseMatrix refineKnots();
     SparseMatrix refineKnotsLocally(double x);
@@ -45,10 +55,12 @@ public:
     // Support related
     void supportHack(double &x) const;
     bool insideSupport(double x) const;
-    bool reduceSupport(double lb, double ub, SparseMatrix &A);
+    // Keeps the basis functions first,...,first+n-1 supported on [lb, ub], where n is the new number of basis functions
+    bool reduceSupport(double lb, double ub, unsigned int &first);
 
     // Getters
     std::vector<double> getKnotVector() const { return knots; }
+    const double *getKnotData() const { return knots.data(); }
     unsigned int getBasisDegree() const { return degree; }
     double getKnotValue(unsigned int index) const;
     unsigned int getNumBasisFunctions() const;
@@ -56,10 +68,15 @@ public:
 
     // Index getters
     std::vector<int> indexSupportedBasisfunctions(double x) const;
+    void indexSupportedBasisfunctions(double lb, double ub, unsigned int &first, unsigned int &last) const; // Nonzero on (lb, ub)
     int indexHalfopenInterval(double x) const;
     unsigned int indexLongestInterval() const;
     unsigned int indexLongestInterval(const std::vector<double> &vec) const;
 
+    // Uniform knots
+    bool hasUniformKnots() const { return uniformBegin < uniformEnd; }
+    bool isUniformSpan(int u) const { return uniformSpanBegin <= u && u < uniformSpanEnd; }
+
     // Setters
     void setNumBasisFunctionsTarget(unsigned int target)
     {
@@ -68,10 +85,6 @@ public:
 
 private:
 
-    // DeBoorCox algorithm for evaluating basis functions
-    double deBoorCox(double x, int i, int k) const;
-    double deBoorCoxCoeff(double x, double x_min, double x_max) const;
-
     // Builds basis matrix for alternative evaluation of basis functions
     SparseMatrix buildBasisMatrix(double x, unsigned int u, unsigned int k, bool diff = false) const;
 
@@ -79,7 +92,6 @@ private:
     SparseMatrix buildKnotInsertionMatrix(const std::vector<double> &refinedKnots) const;
 
     // Helper functions
-    bool inHalfopenInterval(double x, double x_min, double x_max) const;
     std::vector<double> linspace(double start, double stop, unsigned int points) const;
 
     // Knot vector related
@@ -92,10 +104,24 @@ private:
 
     std::vector<double> computeKnotVector(std::vector<double> samples, unsigned int degree);
 
+    // Finds the uniformly spaced knots (must be called whenever the knots change)
+    void updateUniformKnots();
+
+    // Evaluation of the nonzero basis functions (and derivatives) on a span with uniform knots
+    void evaluateUniform(double x, int u, double *values) const;
+    void evaluateUniformDerivatives(double x, int u, unsigned int n, double *derivatives, unsigned int stride) const;
+
     // Member variables
     unsigned int degree;
     std::vector<double> knots;
     unsigned int targetNumBasisfunctions;
+
+    // Knots uniformBegin,...,uniformEnd are uniformly spaced (none if uniformBegin == uniformEnd)
+    int uniformBegin, uniformEnd;
+    double uniformSpacing, uniformInverseSpacing;
+
+    // Spans whose basis functions only depend on the uniform knots
+    int uniformSpanBegin, uniformSpanEnd;
 };
 
 } // namespace SPLINTER
@@ -0,0 +1,81 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef SPLINTER_BSPLINEFITTER_H
+#define SPLINTER_BSPLINEFITTER_H
+
+#include "generaldefinitions.h"
+#include "bspline.h"
+#include "pspline.h"
+#include "linearsolvers.h"
+
+namespace SPLINTER
+{
+
+/**
+ * Fits B-splines to samples on a fixed grid, where only the sample values change between fits.
+ * The knot vectors, knot averages and the LU factorizations of the univariate collocation
+ * matrices are computed once, so that each refit costs a pair of triangular solves per variable.
+ * The sample values given to refit must be ordered as the samples in the DataTable
+ * (as returned by DataTable::getVectorY).
+ */
+class API BSplineFitter
+{
+public:
+    BSplineFitter(const DataTable &samples, unsigned int degree);
+    BSplineFitter(const DataTable &samples, BSplineType type);
+
+    // Returns the B-spline that interpolates the sample values y
+    BSpline refit(const std::vector<double> &y) const;
+
+    unsigned int getNumSamples() const { return numSamples; }
+
+private:
+    BSpline bspline;
+    unsigned int numSamples;
+    std::vector<unsigned int> dims;
+    std::vector<SparseLUFactorization> factorizations;
+
+    void init(const DataTable &samples, unsigned int degree);
+};
+
+/**
+ * Fits P-splines to samples on a fixed (complete) grid, where only the sample values change between fits.
+ * The knot vectors, knot averages, smoothing parameter and the univariate matrices of the P-spline
+ * equations (with their eigendecompositions) are computed once. There is no factorization to reuse
+ * for the P-spline equations, so each refit runs the matrix-free conjugate gradient iterations.
+ * These start from the coefficients of a current fit, so refits after small changes of the
+ * sample values converge in a few iterations.
+ */
+class API PSplineFitter
+{
+public:
+    PSplineFitter(const DataTable &samples, double lambda);
+    PSplineFitter(const DataTable &samples, SmoothingParameterSelection selection);
+
+    // Returns the P-spline fitted to the sample values y (starting from the fit made by the constructor)
+    PSpline refit(const std::vector<double> &y) const;
+
+    // Returns the P-spline fitted to the sample values y, starting from the coefficients of current
+    PSpline refit(const std::vector<double> &y, const BSpline &current) const;
+
+    unsigned int getNumSamples() const { return numSamples; }
+
+private:
+    PSpline pspline;
+    unsigned int numSamples;
+    PSpline::KroneckerSystem system;
+
+    void init(const DataTable &samples);
+    void fit(const DataTable &samples);
+};
+
+} // namespace SPLINTER
+
+#endif // SPLINTER_BSPLINEFITTER_H
@@ -0,0 +1,63 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef SPLINTER_BSPLINESIMD_H
+#define SPLINTER_BSPLINESIMD_H
+
+namespace SPLINTER
+{
+
+// Number of points evaluated together by the vectorized batch kernels
+const unsigned int SIMD_BLOCK_SIZE = 8;
+
+// Limits of the vectorized batch kernels
+const unsigned int SIMD_MAX_NUM_VARIABLES = 16;
+const unsigned int SIMD_MAX_DEGREE = 4;
+
+/*
+ * A block of SIMD_BLOCK_SIZE points stored as a structure of arrays,
+ * together with the tensor product B-spline to evaluate at the points.
+ * All variables must have the same degree (1 to SIMD_MAX_DEGREE).
+ *
+ * x[i*SIMD_BLOCK_SIZE + l] is variable i of point l, and span[i*SIMD_BLOCK_SIZE + l]
+ * is the index u of the knot interval knots[i][u] <= x < knots[i][u+1] that contains it.
+ * The coefficients are ordered with the last variable running fastest.
+ */
+struct SimdBlock
+{
+    unsigned int numVariables;
+    unsigned int degree;
+    const double *knots[SIMD_MAX_NUM_VARIABLES];
+    unsigned int numBasisFunctions[SIMD_MAX_NUM_VARIABLES];
+    const double *coefficients;
+
+    double x[SIMD_MAX_NUM_VARIABLES*SIMD_BLOCK_SIZE];
+    int span[SIMD_MAX_NUM_VARIABLES*SIMD_BLOCK_SIZE];
+};
+
+/*
+ * Evaluates the B-spline at the points of the block and writes the values to y,
+ * which must have room for SIMD_BLOCK_SIZE elements.
+ * The kernel is selected once, at the first call, from the instruction sets supported by the CPU.
+ */
+void evalSimdBlock(const SimdBlock &block, double *y);
+
+// Returns the instruction set used by evalSimdBlock ("avx2" or "generic")
+const char *getSimdInstructionSet();
+
+/*
+ * Kernels compiled for the individual instruction sets (see bsplinesimdkernel.h).
+ * Only the generic kernel is always available.
+ */
+namespace generic { void evalSimdBlock(const SimdBlock &block, double *y); }
+namespace avx2 { void evalSimdBlock(const SimdBlock &block, double *y); }
+
+} // namespace SPLINTER
+
+#endif // SPLINTER_BSPLINESIMD_H
@@ -0,0 +1,232 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+/*
+ * Vectorized batch kernel for tensor product B-splines (see bsplinesimd.h).
+ *
+ * This file is included once per instruction set by a translation unit that is compiled
+ * with the corresponding compiler flags, after defining SPLINTER_SIMD_NAMESPACE to the name
+ * of the instruction set. Everything is defined in that namespace, so the linker never mixes
+ * code compiled for different instruction sets: the helpers are static (internal linkage), and
+ * the entry point evalSimdBlock has external linkage but a different qualified name for each
+ * instruction set. For the same reason, the kernel must not call non-inlined library functions.
+ *
+ * The kernel works on SIMD_BLOCK_SIZE points at a time. Every loop over the points (lanes)
+ * has a fixed trip count and performs the same arithmetic in each lane, which the compiler
+ * turns into SIMD instructions of the target instruction set. The degree is a template
+ * parameter so that the Cox-de Boor triangle and the contraction are fully unrolled.
+ */
+
+#ifndef SPLINTER_SIMD_NAMESPACE
+#error "SPLINTER_SIMD_NAMESPACE must be defined before including bsplinesimdkernel.h"
+#endif
+
+#include "bsplinesimd.h"
+
+namespace SPLINTER
+{
+namespace SPLINTER_SIMD_NAMESPACE
+{
+
+const unsigned int W = SIMD_BLOCK_SIZE;
+
+/*
+ * The nonzero univariate basis function values in each lane.
+ * values[i][k][l] is the value of basis function first[i][l]+k in variable i at point l.
+ */
+template<unsigned int P>
+struct BlockBasis
+{
+    double values[SIMD_MAX_NUM_VARIABLES][P+1][W];
+    int first[SIMD_MAX_NUM_VARIABLES][W];
+};
+
+/*
+ * Evaluates the P+1 nonzero basis functions in each variable and lane using the same
+ * triangular scheme as BSplineBasis1D::evaluateNonZero (algorithm A2.2 in The NURBS Book).
+ */
+template<unsigned int P>
+static void evalBlockBasis(const SimdBlock &block, BlockBasis<P> &basis)
+{
+    for (unsigned int i = 0; i < block.numVariables; i++)
+    {
+        const double *t = block.knots[i];
+        const double *x = block.x + i*W;
+        const int *u = block.span + i*W;
+
+        // Knot differences (the knots are gathered lane by lane)
+        double left[P+1][W], right[P+1][W];
+        for (unsigned int j = 1; j <= P; j++)
+        {
+            for (unsigned int l = 0; l < W; l++)
+            {
+                left[j][l] = x[l] - t[u[l]+1-j];
+                right[j][l] = t[u[l]+j] - x[l];
+            }
+        }
+
+        double N[P+1][W];
+
+        for (unsigned int l = 0; l < W; l++)
+            N[0][l] = 1;
+
+        for (unsigned int j = 1; j <= P; j++)
+        {
+            double saved[W] = {0};
+            for (unsigned int r = 0; r < j; r++)
+            {
+                for (unsigned int l = 0; l < W; l++)
+                {
+                    double temp = N[r][l]/(right[r+1][l] + left[j-r][l]);
+                    N[r][l] = saved[l] + right[r+1][l]*temp;
+                    saved[l] = left[j-r][l]*temp;
+                }
+            }
+
+            for (unsigned int l = 0; l < W; l++)
+                N[j][l] = saved[l];
+        }
+
+        for (unsigned int k = 0; k <= P; k++)
+        {
+            for (unsigned int l = 0; l < W; l++)
+                basis.values[i][k][l] = N[k][l];
+        }
+
+        for (unsigned int l = 0; l < W; l++)
+            basis.first[i][l] = u[l] - P;
+    }
+}
+
+/*
+ * Contraction over the last two variables in each lane. The coefficient rows of the last
+ * variable are gathered lane by lane and accumulated with weights given by the second to last
+ * variable, followed by one dot product with the basis values of the last variable. The points
+ * (lanes) are the innermost loop throughout, so all the arithmetic is vectorized across points.
+ */
+template<unsigned int P>
+static void contractLastBlock(const SimdBlock &block, const BlockBasis<P> &basis, const int *index, double *sum)
+{
+    unsigned int last = block.numVariables - 1;
+    unsigned int n = block.numBasisFunctions[last];
+    const double *c = block.coefficients;
+
+    // Offset of the first supported coefficient row in each lane
+    int offset[W];
+    for (unsigned int l = 0; l < W; l++)
+    {
+        int first = last == 0 ? 0 : index[l]*block.numBasisFunctions[last-1] + basis.first[last-1][l];
+        offset[l] = first*n + basis.first[last][l];
+    }
+
+    double row[P+1][W];
+    if (last == 0)
+    {
+        for (unsigned int k = 0; k <= P; k++)
+            for (unsigned int l = 0; l < W; l++)
+                row[k][l] = c[offset[l] + k];
+    }
+    else
+    {
+        for (unsigned int k = 0; k <= P; k++)
+            for (unsigned int l = 0; l < W; l++)
+                row[k][l] = 0;
+
+        const double (*N)[W] = basis.values[last-1];
+        for (unsigned int j = 0; j <= P; j++)
+        {
+            for (unsigned int k = 0; k <= P; k++)
+            {
+                for (unsigned int l = 0; l < W; l++)
+                    row[k][l] += N[j][l]*c[offset[l] + j*n + k];
+            }
+        }
+    }
+
+    double s[W] = {0};
+    for (unsigned int k = 0; k <= P; k++)
+        for (unsigned int l = 0; l < W; l++)
+            s[l] += basis.values[last][k][l]*row[k][l];
+
+    for (unsigned int l = 0; l < W; l++)
+        sum[l] = s[l];
+}
+
+/*
+ * Lane-wise version of BSpline::contractLocal: sums the supported coefficients times the
+ * product of the univariate basis function values. index[l] is the coefficient index
+ * accumulated over the preceding variables in lane l.
+ */
+template<unsigned int P>
+static void contractBlock(const SimdBlock &block, const BlockBasis<P> &basis, unsigned int dim, const int *index, double *sum)
+{
+    if (dim + 2 >= block.numVariables)
+    {
+        contractLastBlock<P>(block, basis, index, sum);
+        return;
+    }
+
+    const double (*N)[W] = basis.values[dim];
+
+    int first[W];
+    double acc[W];
+    for (unsigned int l = 0; l < W; l++)
+    {
+        first[l] = index[l]*block.numBasisFunctions[dim] + basis.first[dim][l];
+        acc[l] = 0;
+    }
+
+    for (unsigned int k = 0; k <= P; k++)
+    {
+        int next[W];
+        double inner[W];
+        for (unsigned int l = 0; l < W; l++)
+            next[l] = first[l] + k;
+
+        contractBlock<P>(block, basis, dim+1, next, inner);
+
+        for (unsigned int l = 0; l < W; l++)
+            acc[l] += N[k][l]*inner[l];
+    }
+
+    for (unsigned int l = 0; l < W; l++)
+        sum[l] = acc[l];
+}
+
+template<unsigned int P>
+static void evalBlock(const SimdBlock &block, double *y)
+{
+    BlockBasis<P> basis;
+    evalBlockBasis<P>(block, basis);
+
+    int index[W] = {0};
+    contractBlock<P>(block, basis, 0, index, y);
+}
+
+void evalSimdBlock(const SimdBlock &block, double *y)
+{
+    switch (block.degree)
+    {
+    case 1:
+        evalBlock<1>(block, y);
+        break;
+    case 2:
+        evalBlock<2>(block, y);
+        break;
+    case 3:
+        evalBlock<3>(block, y);
+        break;
+    case 4:
+        evalBlock<4>(block, y);
+        break;
+    }
+}
+
+} // namespace SPLINTER_SIMD_NAMESPACE
+} // namespace SPLINTER
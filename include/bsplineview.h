@@ -0,0 +1,82 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef SPLINTER_BSPLINEVIEW_H
+#define SPLINTER_BSPLINEVIEW_H
+
+#include "generaldefinitions.h"
+#include "approximant.h"
+#include "bspline.h"
+#include <memory>
+
+namespace SPLINTER
+{
+
+/**
+ * A B-spline restricted to a box [lb, ub] inside its domain.
+ * The view shares the coefficients of the original B-spline and only stores the bounds and,
+ * for each variable, the range of basis functions that are supported on the box.
+ * Views made by reduceDomain share the B-spline of the view they are made from, which makes
+ * them cheap enough to keep one per node in a branch-and-bound tree.
+ *
+ * On the box, the view evaluates to the same values as the original B-spline, and as
+ * BSpline::reduceDomain(lb, ub). The reduced B-spline (with knots inserted at the bounds)
+ * is only computed when asked for by materialize, from the coefficients inside the view.
+ */
+class API BSplineView : public Approximant
+{
+public:
+    // Makes a copy of the B-spline, which is shared by the view and all views reduced from it
+    BSplineView(const BSpline &bspline);
+
+    // Shares the given B-spline, without copying it
+    BSplineView(std::shared_ptr<const BSpline> bspline);
+
+    virtual BSplineView* clone() const { return new BSplineView(*this); }
+
+    // Returns a view of the box [lb, ub], which must be a nonempty subset of the domain of this view
+    BSplineView reduceDomain(const std::vector<double> &lb, const std::vector<double> &ub) const;
+
+    // Returns the B-spline on the domain of the view (see BSpline::reduceDomain)
+    BSpline materialize(bool doRegularizeKnotVectors = true) const;
+
+    // Bounds on the B-spline over the domain of the view (see BSpline::bounds)
+    void bounds(double &lower, double &upper, bool tight = false) const;
+
+    double eval(const DenseVector &x) const override;
+    DenseMatrix evalJacobian(const DenseVector &x) const override;
+    DenseMatrix evalHessian(const DenseVector &x) const override;
+
+    unsigned int getNumVariables() const override { return numVariables; }
+    std::vector<double> getDomainLowerBound() const { return lb; }
+    std::vector<double> getDomainUpperBound() const { return ub; }
+
+    // Number of basis functions of the original B-spline that are supported on the domain of the view
+    std::vector<unsigned int> getNumBasisFunctions() const { return numBasisFunctions; }
+
+    const BSpline &getBSpline() const { return *bspline; }
+
+    // The view is saved as the materialized B-spline
+    void save(const std::string fileName) const override;
+    void load(const std::string fileName) override;
+
+private:
+    std::shared_ptr<const BSpline> bspline;
+    unsigned int numVariables;
+
+    std::vector<double> lb, ub;
+    std::vector<unsigned int> firstBasisFunction, numBasisFunctions;
+
+    void computeBasisFunctionRanges();
+    bool pointInDomain(const DenseVector &x) const;
+};
+
+} // namespace SPLINTER
+
+#endif // SPLINTER_BSPLINEVIEW_H
@@ -0,0 +1,67 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef SPLINTER_KDTREE_H
+#define SPLINTER_KDTREE_H
+
+#include "generaldefinitions.h"
+
+namespace SPLINTER
+{
+
+/**
+ * A k-d tree over a fixed set of points, for nearest neighbour and radius queries.
+ * The points are the rows of a (numPoints x numVariables) matrix, and queries return
+ * row indices into that matrix. Each node splits its points at the median of the variable
+ * with the largest spread, and the points of a node are stored contiguously (in the order
+ * of the tree), so that the points of a leaf are scanned without indirection.
+ */
+class API KdTree
+{
+public:
+    KdTree(const DenseMatrix &points, unsigned int leafSize = 8);
+
+    // Indices of the k points closest to x, sorted by increasing distance (ties by index)
+    std::vector<unsigned int> nearest(const DenseVector &x, unsigned int k) const;
+
+    // Indices of the points within distance radius of x, sorted by index
+    std::vector<unsigned int> withinRadius(const DenseVector &x, double radius) const;
+
+    unsigned int getNumPoints() const { return indices.size(); }
+    unsigned int getNumVariables() const { return numVariables; }
+
+private:
+    struct Node
+    {
+        unsigned int begin, end;    // Range of the points of the node in indices and points
+        int splitVariable;          // -1 for leaves
+        double splitValue;
+        unsigned int left, right;   // Children (node indices)
+    };
+
+    unsigned int numVariables;
+    unsigned int leafSize;
+
+    // The points reordered so that every node covers a contiguous range of rows,
+    // and the original index of each row
+    DenseMatrix points;
+    std::vector<unsigned int> indices;
+    std::vector<Node> nodes;
+
+    unsigned int build(const DenseMatrix &input, unsigned int begin, unsigned int end);
+
+    typedef std::pair<double, unsigned int> Neighbour; // Squared distance and index
+
+    void nearest(unsigned int node, const DenseVector &x, unsigned int k, std::vector<Neighbour> &heap) const;
+    void withinRadius(unsigned int node, const DenseVector &x, double radius2, std::vector<unsigned int> &result) const;
+};
+
+} // namespace SPLINTER
+
+#endif // SPLINTER_KDTREE_H
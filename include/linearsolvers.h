@@ -13,6 +13,7 @@
 #include "generaldefinitions.h"
 #include "Eigen/IterativeLinearSolvers"
 #include "Eigen/SparseQR"
+#include <memory>
 
 namespace SPLINTER
 {
@@ -121,6 +122,27 @@ private:
     }
 };
 
+class SparseLDLT : public LinearSolver<SparseMatrix, DenseMatrix>
+{
+private:
+    bool doSolve(const SparseMatrix &A, const DenseMatrix &b, DenseMatrix &x) const
+    {
+        // Init sparse Cholesky (LDL') solver (requires symmetric positive definite matrices)
+        Eigen::SimplicialLDLT<SparseMatrix> sparseSolver;
+        sparseSolver.compute(A);
+
+        if (sparseSolver.info() == Eigen::Success)
+        {
+            // Solve LSE
+            x = sparseSolver.solve(b);
+
+            return sparseSolver.info() == Eigen::Success;
+        }
+
+        return false;
+    }
+};
+
 class SparseQR : public LinearSolver<SparseMatrix, DenseMatrix>
 {
 private:
@@ -143,6 +165,113 @@ private:
     }
 };
 
+/*
+ * Sparse LU factorization that is computed once and reused for any number of right-hand sides,
+ * each of which costs a pair of triangular solves. Copies share the factorization.
+ */
+class SparseLUFactorization
+{
+public:
+    SparseLUFactorization()
+        : solver(std::make_shared<Eigen::SparseLU<SparseMatrix>>())
+    {
+    }
+
+    bool compute(const SparseMatrix &A)
+    {
+        rows = A.rows();
+
+        // Init SparseLU solver (requires square matrices)
+        solver = std::make_shared<Eigen::SparseLU<SparseMatrix>>();
+        solver->analyzePattern(A);
+        solver->factorize(A);
+
+        return solver->info() == Eigen::Success;
+    }
+
+    bool solve(const DenseMatrix &b, DenseMatrix &x) const
+    {
+        if (b.rows() != rows)
+            throw Exception("SparseLUFactorization::solve: Inconsistent matrix dimensions!");
+
+        x = solver->solve(b);
+
+        return solver->info() == Eigen::Success;
+    }
+
+private:
+    std::shared_ptr<Eigen::SparseLU<SparseMatrix>> solver;
+    int rows = 0;
+};
+
+/*
+ * Matrix-free preconditioned conjugate gradient method for symmetric positive definite systems Ax = b.
+ * The matrix and the preconditioner are given as operators: applyA(v) returns A*v and
+ * applyPreconditioner(r) returns M^-1*r, where M approximates A. Only vectors are stored, so
+ * structured matrices (e.g. Kronecker products, applied one mode at a time) need not be formed.
+ * On entry, x is the initial guess, which makes a warm start from a previous solution possible
+ * (an x of the wrong size is replaced by zeros).
+ */
+class ConjugateGradient
+{
+public:
+    ConjugateGradient(double tolerance = 1e-12, unsigned int maxNumIterations = 1000)
+        : tolerance(tolerance),
+          maxNumIterations(maxNumIterations),
+          numIterations(0)
+    {
+    }
+
+    // Returns true if the relative residual |b - Ax|/|b| is below the tolerance
+    template<typename Operator, typename Preconditioner>
+    bool solve(Operator applyA, Preconditioner applyPreconditioner, const DenseVector &b, DenseVector &x)
+    {
+        numIterations = 0;
+
+        if (x.size() != b.size())
+            x = DenseVector::Zero(b.size());
+
+        double norm = b.norm();
+        if (norm == 0)
+        {
+            x.setZero();
+            return true;
+        }
+
+        DenseVector r = b - applyA(x);
+        DenseVector z = applyPreconditioner(r);
+        DenseVector p = z;
+        double rz = r.dot(z);
+
+        while (r.norm() > tolerance*norm)
+        {
+            if (numIterations == maxNumIterations)
+                return false;
+
+            DenseVector Ap = applyA(p);
+            double alpha = rz/p.dot(Ap);
+            x += alpha*p;
+            r -= alpha*Ap;
+            z = applyPreconditioner(r);
+
+            double rzNext = r.dot(z);
+            p = z + (rzNext/rz)*p;
+            rz = rzNext;
+
+            numIterations++;
+        }
+
+        return true;
+    }
+
+    unsigned int getNumIterations() const { return numIterations; }
+
+private:
+    double tolerance; // Relative residual tolerance
+    unsigned int maxNumIterations;
+    unsigned int numIterations;
+};
+
 } // namespace SPLINTER
 
 #endif // SPLINTER_LINEARSOLVER_H
@@ -17,6 +17,24 @@ namespace SPLINTER
 
 void myKroneckerProduct(const SparseMatrix &A, const SparseMatrix &B, SparseMatrix &AB);
 
+/*
+ * Tensors are stored as vectors with the last index running fastest (the ordering of the
+ * coefficients of a tensor product B-spline and of the samples in a complete grid).
+ * A Kronecker product (A_1 x ... x A_d) applied to such a vector acts on each index (mode)
+ * separately, so it can be applied one mode at a time by unfolding the tensor:
+ * unfoldTensor copies mode k of a tensor with dimensions dims to the rows of a
+ * dims[k] x (size/dims[k]) matrix, and foldTensor copies it back, setting dims[k] = matrix.rows().
+ */
+void unfoldTensor(const DenseVector &tensor, const std::vector<unsigned int> &dims, unsigned int mode, DenseMatrix &matrix);
+void foldTensor(const DenseMatrix &matrix, std::vector<unsigned int> &dims, unsigned int mode, DenseVector &tensor);
+
+/*
+ * Mode product: multiplies mode k of the tensor by A, i.e. applies I x ... x A x ... x I.
+ * Sets dims[k] = A.rows().
+ */
+void tensorModeProduct(const DenseMatrix &A, std::vector<unsigned int> &dims, unsigned int mode, DenseVector &tensor);
+void tensorModeProduct(const SparseMatrix &A, std::vector<unsigned int> &dims, unsigned int mode, DenseVector &tensor);
+
 } // namespace SPLINTER
 
 #endif // SPLINTER_MYKRONECKERPRODUCT_H
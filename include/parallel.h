@@ -0,0 +1,95 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef SPLINTER_PARALLEL_H
+#define SPLINTER_PARALLEL_H
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace SPLINTER
+{
+
+/*
+ * Returns the number of threads to use when numThreads threads are requested.
+ * A request of zero threads means one thread per hardware thread.
+ */
+inline unsigned int resolveNumThreads(unsigned int numThreads)
+{
+    if (numThreads == 0)
+        numThreads = std::thread::hardware_concurrency();
+    return std::max(numThreads, 1u);
+}
+
+/*
+ * Splits [begin, end) into contiguous chunks of (roughly) equal size and calls
+ * f(chunkBegin, chunkEnd) for each chunk on its own thread.
+ * The calling thread processes the first chunk, so a single thread never spawns.
+ * The first exception thrown by f is rethrown on the calling thread after all threads have joined.
+ */
+template<typename Function>
+void parallelFor(unsigned int begin, unsigned int end, unsigned int numThreads, Function f)
+{
+    if (end <= begin)
+        return;
+
+    unsigned int count = end - begin;
+    numThreads = std::min(resolveNumThreads(numThreads), count);
+
+    if (numThreads == 1)
+    {
+        f(begin, end);
+        return;
+    }
+
+    std::vector<std::exception_ptr> errors(numThreads);
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+
+    auto chunkBegin = [=](unsigned int t) { return begin + (unsigned int)(((unsigned long long)count*t)/numThreads); };
+
+    for (unsigned int t = 1; t < numThreads; t++)
+    {
+        threads.emplace_back([&, t]()
+        {
+            try
+            {
+                f(chunkBegin(t), chunkBegin(t+1));
+            }
+            catch (...)
+            {
+                errors.at(t) = std::current_exception();
+            }
+        });
+    }
+
+    try
+    {
+        f(chunkBegin(0), chunkBegin(1));
+    }
+    catch (...)
+    {
+        errors.at(0) = std::current_exception();
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    for (auto &error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+}
+
+} // namespace SPLINTER
+
+#endif // SPLINTER_PARALLEL_H
@@ -0,0 +1,67 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef SPLINTER_PIECEWISEPOLYNOMIAL_H
+#define SPLINTER_PIECEWISEPOLYNOMIAL_H
+
+#include "generaldefinitions.h"
+#include "approximant.h"
+#include "bspline.h"
+
+namespace SPLINTER
+{
+
+/**
+ * A tensor product B-spline "compiled" to piecewise polynomial form.
+ * The B-spline is decomposed into Bezier form, and the Bernstein coefficients of each
+ * cell (a product of knot intervals) are converted to power basis coefficients in the
+ * local coordinates x - a, where a is the lower corner of the cell. The coefficients of
+ * each cell are stored contiguously, so evaluation is a cell lookup followed by a nested
+ * Horner scheme. This trades memory (prod_i (p_i+1) coefficients per cell) for speed,
+ * and is intended for low-dimensional splines that are evaluated many times.
+ */
+class API PiecewisePolynomial : public Approximant
+{
+public:
+    PiecewisePolynomial(const BSpline &bspline);
+    PiecewisePolynomial(const std::string fileName);
+
+    virtual PiecewisePolynomial* clone() const { return new PiecewisePolynomial(*this); }
+
+    double eval(const DenseVector &x) const override;
+    DenseMatrix evalJacobian(const DenseVector &x) const override;
+    DenseMatrix evalHessian(const DenseVector &x) const override;
+
+    unsigned int getNumVariables() const override { return numVariables; }
+    unsigned int getNumCells() const;
+
+    void save(const std::string fileName) const override;
+    void load(const std::string fileName) override;
+
+private:
+    unsigned int numVariables;
+    std::vector<unsigned int> degrees;
+    std::vector< std::vector<double> > breakpoints; // Distinct knots in each variable
+
+    // Coefficient c_k of cell j is stored at coefficients[j*cellSize + sum_i k_i*strides[i]]
+    // (the last variable runs fastest, both for the cells and within a cell)
+    std::vector<unsigned int> strides;
+    unsigned int cellSize;
+    std::vector<double> coefficients;
+
+    // Returns the coefficients of the cell containing x and the local coordinates of x
+    const double *findCell(const DenseVector &x, double *dx) const;
+
+    // Nested Horner scheme for the partial derivative of the given orders
+    double horner(const double *c, const double *dx, const unsigned int *orders, unsigned int dim = 0) const;
+};
+
+} // namespace SPLINTER
+
+#endif // SPLINTER_PIECEWISEPOLYNOMIAL_H
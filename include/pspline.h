@@ -15,6 +15,17 @@
 namespace SPLINTER
 {
 
+// Methods for selecting the smoothing parameter of a P-spline
+enum class SmoothingParameterSelection
+{
+    /*
+     * Generalized cross-validation. With two or more variables and more than 512 coefficients, the score
+     * is computed for a separable surrogate of the penalty (G_j = B_j'*B_j in place of the identity in the
+     * other variables), so the selected value approximates the minimizer of the exact score.
+     */
+    GCV
+};
+
 /*
  * The P-Spline is a smooting spline which relaxes the interpolation constraints on the control points to allow smoother spline curves.
  * It minimizes objective which penalizes both deviation (for interpolation) and second derivative (for smoothing).
@@ -22,18 +33,59 @@ namespace SPLINTER
  */
 class API PSpline : public BSpline
 {
+    friend class PSplineFitter;
+
 public:
 
     PSpline(const DataTable &samples);
     PSpline(const DataTable &samples, double lambda);
 
+    // Construct P-spline with an automatically selected smoothing parameter (requires a complete grid)
+    PSpline(const DataTable &samples, SmoothingParameterSelection selection);
+
+    /*
+     * Construct P-spline by penalized least squares fitting to scattered samples (not necessarily on a grid),
+     * with the given knot vectors and basis degrees. The optional weights (one per sample, ordered as the
+     * samples in the DataTable) weight the squared residuals and must be nonnegative. The smoothing parameter
+     * must be positive if some basis functions are not supported by the samples. The normal equations are
+     * assembled with numThreads threads (0 means one thread per hardware thread). Each thread accumulates
+     * its own band of the normal matrix, of numBasisFunctions*prod_i (2p_i+1) doubles.
+     */
+    PSpline(const DataTable &samples, std::vector< std::vector<double> > knotVectors, std::vector<unsigned int> basisDegrees,
+            double lambda, const std::vector<double> &weights = std::vector<double>(), unsigned int numThreads = 1);
+
+    double getLambda() const { return lambda; }
+
 protected:
 
+    PSpline();
+
     // Smoothing parameter (usually set to a small number; default 0.03)
     double lambda;
 
     // P-spline control point calculation
     void computeControlPoints(const DataTable &samples) override;
+    bool computeControlPointsKronecker(const DataTable &samples) override;
+
+    // Univariate matrices of the P-spline equations on a complete grid (see computeControlPointsKronecker)
+    struct KroneckerSystem
+    {
+        std::vector<unsigned int> sampleDims, dims;
+        std::vector<SparseMatrix> B, G, P;
+        std::vector<DenseMatrix> U;
+        DenseVector penaltyEigenvalues; // Diagonal of M_1 + ... + M_d
+    };
+
+    bool computeKroneckerSystem(const DataTable &samples, KroneckerSystem &system) const;
+    bool solveKroneckerSystem(const DataTable &samples, const KroneckerSystem &system);
+    bool solveKroneckerSystem(const KroneckerSystem &system, DenseVector y, DenseVector &c) const;
+    double selectLambda(const DataTable &samples, const KroneckerSystem &system, SmoothingParameterSelection selection) const;
+    double selectLambdaGCV(const DataTable &samples, const KroneckerSystem &system) const;
+
+    void computeControlPointsScattered(const DataTable &samples, const std::vector<double> &weights, unsigned int numThreads);
+    void computeNormalMatrix(const DataTable &samples, const std::vector<double> &weights, unsigned int numThreads,
+                             SparseMatrix &BWB, DenseVector &BWy) const;
+
     void getSecondOrderFiniteDifferenceMatrix(SparseMatrix &D);
 
 };
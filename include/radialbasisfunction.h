@@ -27,85 +27,155 @@ enum class RadialBasisFunctionType
 };
 
 /*
- * Base class for radial basis functions.
+ * Kernel policies for the radial basis functions. Each kernel is written as a function of the
+ * squared distance r2 = r^2 and the shape parameter e, so that only the thin-plate spline needs
+ * the logarithm of r (and no kernel needs a square root of r2 to evaluate).
+ * evalArray evaluates the kernel at many squared distances (a vector or a matrix of them)
+ * with an Eigen array expression.
+ * RadialBasisFunction selects the kernel once, at construction, and instantiates its assembly
+ * and evaluation loops for each kernel, so that the kernel is inlined and vectorized.
  */
-class RadialBasisFunctionTerm
+struct ThinPlateSplineKernel
 {
-public:
-    RadialBasisFunctionTerm() : e(1.0) {}
-    RadialBasisFunctionTerm(double e) : e(e) {}
-    virtual double eval(double r) const = 0;
-    virtual double evalDerivative(double r) const = 0;
-    virtual ~RadialBasisFunctionTerm() {}
-protected:
-    double e;
-};
+    static const bool positiveDefinite = false;
 
-class ThinPlateSpline : public RadialBasisFunctionTerm
-{
-public:
-    double eval(double r) const
+    // r^2 log(r) = r^2 log(r^2)/2
+    static double eval(double r2, double /*e*/)
     {
-        return (r<=0.0) ? 0.0 : r*r*std::log(r);
+        return (r2<=0.0) ? 0.0 : 0.5*r2*std::log(r2);
     }
-    double evalDerivative(double r) const
+    template<typename ArrayType>
+    static void evalArray(const ArrayType &r2, double /*e*/, ArrayType &values)
+    {
+        values = (r2 > 0.0).select(0.5*r2*r2.max(1e-300).log(), 0.0);
+    }
+    static double evalDerivative(double r, double /*e*/)
     {
         return (r<=0.0) ? 0.0 : r*(2*log(r) + 1);
     }
 };
 
-class Multiquadric : public RadialBasisFunctionTerm
+struct MultiquadricKernel
 {
-public:
-    double eval(double r) const
+    static const bool positiveDefinite = false;
+
+    static double eval(double r2, double e)
     {
-        return std::sqrt(1.0 + e*e*r*r);
+        return std::sqrt(1.0 + e*e*r2);
     }
-    double evalDerivative(double r) const
+    template<typename ArrayType>
+    static void evalArray(const ArrayType &r2, double e, ArrayType &values)
+    {
+        values = (1.0 + e*e*r2).sqrt();
+    }
+    static double evalDerivative(double r, double e)
     {
         return e*e*r/std::sqrt(1 + e*e*r*r);
     }
 };
 
-class InverseMultiquadric : public RadialBasisFunctionTerm
+struct InverseMultiquadricKernel
 {
-public:
-    double eval(double r) const
+    static const bool positiveDefinite = true;
+
+    static double eval(double r2, double e)
     {
-        return 1.0/std::sqrt(1.0 + e*e*r*r);
+        return 1.0/std::sqrt(1.0 + e*e*r2);
     }
-    double evalDerivative(double r) const
+    template<typename ArrayType>
+    static void evalArray(const ArrayType &r2, double e, ArrayType &values)
+    {
+        values = (1.0 + e*e*r2).sqrt().inverse();
+    }
+    static double evalDerivative(double r, double e)
     {
         return -e*e*r/(std::sqrt(1 + e*e*r*r)*(1 + e*e*r*r));
     }
 };
 
-class InverseQuadric : public RadialBasisFunctionTerm
+struct InverseQuadricKernel
 {
-public:
-    double eval(double r) const
+    static const bool positiveDefinite = true;
+
+    static double eval(double r2, double e)
     {
-        return 1.0/(1.0 + e*e*r*r);
+        return 1.0/(1.0 + e*e*r2);
     }
-    double evalDerivative(double r) const
+    template<typename ArrayType>
+    static void evalArray(const ArrayType &r2, double e, ArrayType &values)
+    {
+        values = (1.0 + e*e*r2).inverse();
+    }
+    static double evalDerivative(double r, double e)
     {
         return -2*e*e*r/((1 + e*e*r*r)*(1 + e*e*r*r));
     }
 };
 
-class Gaussian : public RadialBasisFunctionTerm
+struct GaussianKernel
+{
+    static const bool positiveDefinite = true;
+
+    static double eval(double r2, double e)
+    {
+        return std::exp(-e*e*r2);
+    }
+    template<typename ArrayType>
+    static void evalArray(const ArrayType &r2, double e, ArrayType &values)
+    {
+        values = (-e*e*r2).exp();
+    }
+    static double evalDerivative(double r, double e)
+    {
+        return -2*e*e*r*std::exp(-e*e*r*r);
+    }
+};
+
+/*
+ * Base class for radial basis functions.
+ */
+class RadialBasisFunctionTerm
+{
+public:
+    RadialBasisFunctionTerm() : e(1.0) {}
+    RadialBasisFunctionTerm(double e) : e(e) {}
+    virtual double eval(double r) const = 0;
+    virtual double evalDerivative(double r) const = 0;
+
+    // True if the interpolation matrix is positive definite for any set of distinct points
+    virtual bool isPositiveDefinite() const = 0;
+
+    double getShapeParameter() const { return e; }
+
+    virtual ~RadialBasisFunctionTerm() {}
+protected:
+    double e;
+};
+
+template<class Kernel>
+class RadialBasisFunctionKernel : public RadialBasisFunctionTerm
 {
 public:
     double eval(double r) const
     {
-        return std::exp(-e*e*r*r);
+        return Kernel::eval(r*r, e);
     }
     double evalDerivative(double r) const
     {
-        return -2*e*e*r*std::exp(-e*e*r*r);
+        return Kernel::evalDerivative(r, e);
+    }
+    bool isPositiveDefinite() const
+    {
+        return Kernel::positiveDefinite;
     }
 };
 
+typedef RadialBasisFunctionKernel<ThinPlateSplineKernel> ThinPlateSpline;
+typedef RadialBasisFunctionKernel<MultiquadricKernel> Multiquadric;
+typedef RadialBasisFunctionKernel<InverseMultiquadricKernel> InverseMultiquadric;
+typedef RadialBasisFunctionKernel<InverseQuadricKernel> InverseQuadric;
+typedef RadialBasisFunctionKernel<GaussianKernel> Gaussian;
+
 /*
  * Class for radial basis function splines.
  * The RBF splines support scattered sampling, but their construction require
@@ -119,13 +189,16 @@ public:
     RadialBasisFunction(const DataTable &samples, RadialBasisFunctionType type);
     RadialBasisFunction(const DataTable &samples, RadialBasisFunctionType type, bool normalized);
 
+    // With precondition, the interpolation system is multiplied by a sparse ACBF preconditioner before it is solved
+    RadialBasisFunction(const DataTable &samples, RadialBasisFunctionType type, bool normalized, bool precondition);
+
     virtual RadialBasisFunction* clone() const { return new RadialBasisFunction(*this); }
 
-    double eval(DenseVector x) const;
+    double eval(const DenseVector &x) const;
     double eval(std::vector<double> x) const;
 
-    DenseMatrix evalJacobian(DenseVector x) const { return DenseMatrix(); }; // TODO: implement via RBF_fn
-    DenseMatrix evalHessian(DenseVector x) const { return DenseMatrix(); }; // TODO: implement via RBF_fn
+    DenseMatrix evalJacobian(const DenseVector &x) const { return DenseMatrix(); }; // TODO: implement via RBF_fn
+    DenseMatrix evalHessian(const DenseVector &x) const { return DenseMatrix(); }; // TODO: implement via RBF_fn
     //    std::vector<double> getDomainUpperBound() const;
     //    std::vector<double> getDomainLowerBound() const;
 
@@ -134,110 +207,47 @@ public:
     void save(const std::string fileName) const override {}
     void load(const std::string fileName) override {}
 
+protected:
+
+    /*
+     * Batch evaluation (see Approximant). The points are processed in blocks against blocks of centers,
+     * with the squared distances ||x||^2 + ||c||^2 - 2 x'c of a pair of blocks computed by one
+     * matrix-matrix product. The kernel is then applied elementwise and the weights by a matrix-vector product.
+     */
+    void evalBatchRange(const DenseMatrix &x, PointLayout layout,
+                        unsigned int begin, unsigned int end, DenseVector &y) const override;
+
 private:
 
-    const DataTable samples;
     bool normalized, precondition;
     unsigned int dim, numSamples;
 
     std::shared_ptr<RadialBasisFunctionTerm> fn;
 
+    // Centers stored by variable (numSamples x dim), so that the distances to all centers are computed
+    // one variable at a time over contiguous memory. The centers are shifted by -origin (their centroid),
+    // which limits the cancellation in the squared distances of the batch evaluation.
+    DenseMatrix centers;
+    DenseVector origin;
+    Eigen::ArrayXd centerSquaredNorms;
     DenseMatrix weights;
 
-    DenseMatrix computePreconditionMatrix() const;
+    // Squared distances from x to all centers
+    void computeSquaredDistances(const DenseVector &x, Eigen::ArrayXd &r2) const;
 
-    double dist(std::vector<double> x, std::vector<double> y) const;
-    double dist(DataSample x, DataSample y) const;
-    bool dist_sort(DataSample x, DataSample y) const;
+    // Assembly of the interpolation matrix and evaluation, instantiated for the kernel chosen at construction
+    void (RadialBasisFunction::*assemble)(DenseMatrix &A) const;
+    double (RadialBasisFunction::*evaluate)(const DenseVector &x) const;
+    void (RadialBasisFunction::*evaluateBatch)(const DenseMatrix &x, PointLayout layout,
+                                               unsigned int begin, unsigned int end, DenseVector &y) const;
 
-};
-
-/*
- * Helper class for pre-condition matrix calculation
- */
-class Point
-{
-public:
-    Point(std::vector<double> p) : p(p),i(0) {}
-
-    bool operator<(const Point &rhs) const
-    {
-        // Compare dist to origin
-        assert(getDim() == rhs.getDim());
-        if (dist() < rhs.dist())
-            return true;
-        return false;
-    }
+    template<class Kernel> void setKernel();
+    template<class Kernel> void assembleMatrix(DenseMatrix &A) const;
+    template<class Kernel> double evalKernel(const DenseVector &x) const;
+    template<class Kernel> void evalBatchKernel(const DenseMatrix &x, PointLayout layout,
+                                                unsigned int begin, unsigned int end, DenseVector &y) const;
 
-    bool operator==(const Point &rhs) const
-    {
-        if (getDim() != rhs.getDim())
-            return false;
-
-        for (unsigned int i = 0; i < getDim(); i++)
-            if (p.at(i) != rhs.getPoint().at(i))
-                return false;
-
-        return true;
-    }
-
-    Point& operator+=(const Point &rhs)
-    {
-        assert(getDim() == rhs.getDim());
-        for (unsigned int i = 0; i < p.size(); i++)
-            p.at(i) += rhs.getPoint().at(i);
-        return (*this);
-    }
-
-    Point& operator-=(const Point &rhs)
-    {
-        assert(getDim() == rhs.getDim());
-        for (unsigned int i = 0; i < p.size(); i++)
-            p.at(i) -= rhs.getPoint().at(i);
-        return (*this);
-    }
-
-    Point operator+(const Point &rhs) const
-    {
-        assert(getDim() == rhs.getDim());
-        Point temp(p);
-        temp += rhs;
-        return temp;
-    }
-
-    Point operator-(const Point &rhs) const
-    {
-        assert(getDim() == rhs.getDim());
-        Point temp(p);
-        temp -= rhs;
-        return temp;
-    }
-
-    double dist(const Point &rhs) const
-    {
-        assert(getDim() == rhs.getDim());
-        double sum = 0;
-        for (unsigned int i=0; i<getDim(); i++)
-            sum += (p.at(i)-rhs.getPoint().at(i))*(p.at(i)-rhs.getPoint().at(i));
-        return std::sqrt(sum);
-    }
-
-    double dist() const
-    {
-        std::vector<double> origin(getDim(),0.0);
-        return dist(Point(origin));
-    }
-
-    //friend std::ostream &operator<<(std::ostream &outputStream, const DataSample &sample);
-
-    std::vector<double> getPoint() const { return p; }
-    unsigned int getDim() const { return p.size(); }
-    unsigned int getIndex() const { return i; }
-    void setIndex(unsigned int index) { i=index; }
-
-private:
-    std::vector<double> p;
-    unsigned int i;
+    SparseMatrix computePreconditionMatrix() const;
 };
 
 } // namespace SPLINTER
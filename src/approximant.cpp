@@ -0,0 +1,81 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "approximant.h"
+#include "parallel.h"
+
+namespace SPLINTER
+{
+
+void Approximant::evalBatch(const DenseMatrix &x, DenseVector &y, PointLayout layout, unsigned int numThreads) const
+{
+    unsigned int numPoints = getNumBatchPoints(x, layout);
+    y.resize(numPoints);
+
+    parallelFor(0, numPoints, numThreads, [&](unsigned int begin, unsigned int end)
+    {
+        evalBatchRange(x, layout, begin, end, y);
+    });
+}
+
+void Approximant::evalJacobianBatch(const DenseMatrix &x, DenseMatrix &jacobians, PointLayout layout, unsigned int numThreads) const
+{
+    unsigned int numPoints = getNumBatchPoints(x, layout);
+    jacobians.resize(numPoints, getNumVariables());
+
+    parallelFor(0, numPoints, numThreads, [&](unsigned int begin, unsigned int end)
+    {
+        evalJacobianBatchRange(x, layout, begin, end, jacobians);
+    });
+}
+
+void Approximant::evalBatchRange(const DenseMatrix &x, PointLayout layout,
+                                 unsigned int begin, unsigned int end, DenseVector &y) const
+{
+    DenseVector xi(getNumVariables());
+
+    for (unsigned int i = begin; i < end; i++)
+    {
+        getBatchPoint(x, layout, i, xi);
+        y(i) = eval(xi);
+    }
+}
+
+void Approximant::evalJacobianBatchRange(const DenseMatrix &x, PointLayout layout,
+                                         unsigned int begin, unsigned int end, DenseMatrix &jacobians) const
+{
+    DenseVector xi(getNumVariables());
+
+    for (unsigned int i = begin; i < end; i++)
+    {
+        getBatchPoint(x, layout, i, xi);
+        DenseMatrix jacobian = evalJacobian(xi);
+
+        if (jacobian.rows() != 1 || jacobian.cols() != jacobians.cols())
+            throw Exception("Approximant::evalJacobianBatch: Jacobian not available.");
+
+        jacobians.row(i) = jacobian;
+    }
+}
+
+unsigned int Approximant::getNumBatchPoints(const DenseMatrix &x, PointLayout layout) const
+{
+    if (layout == PointLayout::COLUMNS)
+    {
+        if (x.rows() != getNumVariables())
+            throw Exception("Approximant::evalBatch: Expected one point per column with getNumVariables() rows.");
+        return x.cols();
+    }
+
+    if (x.cols() != getNumVariables())
+        throw Exception("Approximant::evalBatch: Expected one point per row with getNumVariables() columns.");
+    return x.rows();
+}
+
+} // namespace SPLINTER
@@ -14,6 +14,8 @@
 #include "linearsolvers.h"
 #include "serialize.h"
 #include <iostream>
+#include <algorithm>
+#include <limits>
 
 namespace SPLINTER
 {
@@ -123,6 +125,26 @@ BSpline::BSpline(const DataTable &samples, BSplineType type = BSplineType::CUBIC
     checkControlPoints();
 }
 
+BSpline BSpline::multilevelApproximation(const DataTable &samples, unsigned int degree, unsigned int numLevels)
+{
+    if (samples.getNumSamples() == 0)
+        throw Exception("BSpline::multilevelApproximation: Cannot create B-spline without samples.");
+
+    if (numLevels == 0)
+        throw Exception("BSpline::multilevelApproximation: The number of levels must be positive.");
+
+    BSpline bspline;
+    bspline.numVariables = samples.getNumVariables();
+
+    bspline.computeMultilevelApproximation(samples, degree, numLevels);
+
+    bspline.init();
+
+    bspline.checkControlPoints();
+
+    return bspline;
+}
+
 /*
  * Construct from saved data
  */
@@ -141,16 +163,25 @@ void BSpline::init()
     }
 }
 
-double BSpline::eval(DenseVector x) const
+double BSpline::eval(const DenseVector &x) const
 {
 	if (!pointInDomain(x))
 	{
 		throw Exception("BSpline::eval: Evaluation at point outside domain.");
 	}
 
-	SparseVector tensorvalues = basis.eval(x);
-	DenseVector y = coefficients*tensorvalues;
-	return y(0);
+	if (!basis.fitsLocalBasis())
+	{
+		SparseVector tensorvalues = basis.eval(x);
+		DenseVector y = coefficients*tensorvalues;
+		return y(0);
+	}
+
+	LocalBasis local;
+	basis.evalLocal(x, local);
+
+	unsigned int orders[MAX_LOCAL_NUM_VARIABLES] = {0};
+	return contractLocal(local, orders);
 }
 
 double BSpline::eval(double x) const
@@ -165,28 +196,125 @@ double BSpline::eval(double x) const
  * The Jacobian is an 1 x n matrix,
  * where n is the dimension of x.
  */
-DenseMatrix BSpline::evalJacobian(DenseVector x) const
+DenseMatrix BSpline::evalJacobian(const DenseVector &x) const
 {
     if (!pointInDomain(x))
     {
         throw Exception("BSpline::evalJacobian: Evaluation at point outside domain.");
     }
 
-    //SparseMatrix BiOld = basis.evalBasisJacobian(x);       // Sparse Jacobian implementation
-    //SparseMatrix Bi = basis.evalBasisJacobian2(x);  // Sparse Jacobian implementation using fold
-    DenseMatrix BiOld = basis.evalBasisJacobianOld(x);  // Old Jacobian implementation
+    if (!basis.fitsLocalBasis())
+    {
+        DenseMatrix BiOld = basis.evalBasisJacobianOld(x);
+        return coefficients*BiOld;
+    }
+
+    // Values and first derivatives of the nonzero basis functions
+    LocalBasis local;
+    basis.evalLocal(x, local, 1);
+
+    DenseMatrix J(1, numVariables);
+    contractLocalJacobian(local, J.data(), 1);
+
+    return J;
+}
+
+/*
+ * Batch evaluation: one basis workspace is reused for all points in the range,
+ * and the kernel is called directly instead of through the virtual eval.
+ * Splines of degree 1 to 4 are evaluated by the vectorized kernels in bsplinesimd.h.
+ */
+void BSpline::evalBatchRange(const DenseMatrix &x, PointLayout layout,
+                             unsigned int begin, unsigned int end, DenseVector &y) const
+{
+    if (!basis.fitsLocalBasis())
+    {
+        Approximant::evalBatchRange(x, layout, begin, end, y);
+        return;
+    }
+
+    DenseVector xi(numVariables);
+
+    if (basis.fitsSimdBlock())
+    {
+        // Blocks of SIMD_BLOCK_SIZE points are evaluated together by the vectorized kernel.
+        // A partial last block is padded with copies of its last point.
+        SimdBlock block;
+        basis.initSimdBlock(block);
+        block.coefficients = coefficients.data();
+
+        double yBlock[SIMD_BLOCK_SIZE];
+
+        for (unsigned int i = begin; i < end; i += SIMD_BLOCK_SIZE)
+        {
+            unsigned int blockSize = std::min(SIMD_BLOCK_SIZE, end - i);
+
+            for (unsigned int l = 0; l < SIMD_BLOCK_SIZE; l++)
+            {
+                if (l < blockSize)
+                {
+                    getBatchPoint(x, layout, i + l, xi);
+
+                    if (!pointInDomain(xi))
+                    {
+                        throw Exception("BSpline::evalBatch: Evaluation at point outside domain.");
+                    }
+                }
+
+                basis.setSimdBlockPoint(block, l, xi);
+            }
+
+            evalSimdBlock(block, yBlock);
+
+            for (unsigned int l = 0; l < blockSize; l++)
+                y(i + l) = yBlock[l];
+        }
+
+        return;
+    }
+
+    LocalBasis local;
+    unsigned int orders[MAX_LOCAL_NUM_VARIABLES] = {0};
+
+    for (unsigned int i = begin; i < end; i++)
+    {
+        getBatchPoint(x, layout, i, xi);
 
-//      Test difference in Jacobians
-//     DenseMatrix dJ = Bi - BiOld;
-//     DenseVector errorVec = dJ.rowwise().maxCoeff();
-//     DenseVector error = errorVec.colwise().maxCoeff();
-//     if (std::abs(error(0)) > 1e-10)
-//     {
-//         std::cout << "NOTABLE DIFFERENCE IN JACOBIANS: " << std::abs(error(0)) << std::endl;
-//         exit(1);
-//     }
+        if (!pointInDomain(xi))
+        {
+            throw Exception("BSpline::evalBatch: Evaluation at point outside domain.");
+        }
 
-    return coefficients*BiOld;
+        basis.evalLocal(xi, local);
+        y(i) = contractLocal(local, orders);
+    }
+}
+
+void BSpline::evalJacobianBatchRange(const DenseMatrix &x, PointLayout layout,
+                                     unsigned int begin, unsigned int end, DenseMatrix &jacobians) const
+{
+    if (!basis.fitsLocalBasis())
+    {
+        Approximant::evalJacobianBatchRange(x, layout, begin, end, jacobians);
+        return;
+    }
+
+    DenseVector xi(numVariables);
+    LocalBasis local;
+
+    for (unsigned int i = begin; i < end; i++)
+    {
+        getBatchPoint(x, layout, i, xi);
+
+        if (!pointInDomain(xi))
+        {
+            throw Exception("BSpline::evalJacobianBatch: Evaluation at point outside domain.");
+        }
+
+        // Row i of the column-major output has stride numPoints
+        basis.evalLocal(xi, local, 1);
+        contractLocalJacobian(local, jacobians.data() + i, jacobians.rows());
+    }
 }
 
 /*
@@ -194,20 +322,46 @@ DenseMatrix BSpline::evalJacobian(DenseVector x) const
  * The Hessian is an n x n matrix,
  * where n is the dimension of x.
  */
-DenseMatrix BSpline::evalHessian(DenseVector x) const
+DenseMatrix BSpline::evalHessian(const DenseVector &x) const
 {
     if (!pointInDomain(x))
     {        
         throw Exception("BSpline::evalHessian: Evaluation at point outside domain.");
     }
 
-    DenseMatrix H;
-    H.setZero(1,1);
-    DenseMatrix identity = DenseMatrix::Identity(numVariables,numVariables);
-    DenseMatrix caug;
-    caug = kroneckerProduct(identity, coefficients);
-    DenseMatrix DB = basis.evalBasisHessian(x);
-    H = caug*DB;
+    if (!basis.fitsLocalBasis())
+    {
+        DenseMatrix identity = DenseMatrix::Identity(numVariables,numVariables);
+        DenseMatrix caug = kroneckerProduct(identity, coefficients);
+        DenseMatrix DB = basis.evalBasisHessian(x);
+        DenseMatrix H = caug*DB;
+
+        // The basis Hessian only fills the lower triangular part
+        H.triangularView<Eigen::StrictlyUpper>() = H.transpose().eval();
+        return H;
+    }
+
+    // Values, first and second derivatives of the nonzero basis functions
+    LocalBasis local;
+    basis.evalLocal(x, local, 2);
+
+    // One contraction per unique second partial derivative (the Hessian is symmetric)
+    DenseMatrix H(numVariables, numVariables);
+    unsigned int orders[MAX_LOCAL_NUM_VARIABLES] = {0};
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        for (unsigned int j = 0; j <= i; j++)
+        {
+            orders[i]++;
+            orders[j]++;
+            H(i,j) = contractLocal(local, orders);
+            H(j,i) = H(i,j);
+            orders[i]--;
+            orders[j]--;
+        }
+    }
+
     return H;
 }
 
@@ -271,11 +425,59 @@ void BSpline::checkControlPoints() const
         throw Exception("BSpline::checkControlPoints: Coefficients matrix does not have one row.");
 }
 
-bool BSpline::pointInDomain(DenseVector x) const
+bool BSpline::pointInDomain(const DenseVector &x) const
 {
     return basis.insideSupport(x);
 }
 
+/*
+ * Computes the sum over the (p+1)^n supported coefficients of the coefficient
+ * times the product of the univariate basis function values, without forming
+ * the tensor product basis. In variable i, the derivative of order orders[i] of the
+ * univariate basis functions is used, so that partial derivatives are computed
+ * with the same contraction. The coefficients are ordered with the last variable
+ * running fastest, so that index accumulates the coefficient index of the
+ * preceding variables.
+ */
+double BSpline::contractLocal(const LocalBasis &local, const unsigned int *orders, unsigned int dim, unsigned int index) const
+{
+    assert(orders[dim] <= local.numDerivatives);
+
+    const double *values = local.values[dim][orders[dim]];
+    unsigned int first = index*local.numBasisFunctions[dim] + local.first[dim];
+    double sum = 0;
+
+    if (dim + 1 == local.numVariables)
+    {
+        const double *c = coefficients.data() + first;
+        for (unsigned int k = 0; k < local.size[dim]; k++)
+            sum += values[k]*c[k];
+    }
+    else
+    {
+        for (unsigned int k = 0; k < local.size[dim]; k++)
+            sum += values[k]*contractLocal(local, orders, dim+1, first+k);
+    }
+
+    return sum;
+}
+
+/*
+ * One contraction per partial derivative. The derivative with respect to
+ * variable i is written to jacobian[i*stride].
+ */
+void BSpline::contractLocalJacobian(const LocalBasis &local, double *jacobian, unsigned int stride) const
+{
+    unsigned int orders[MAX_LOCAL_NUM_VARIABLES] = {0};
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        orders[i] = 1;
+        jacobian[i*stride] = contractLocal(local, orders);
+        orders[i] = 0;
+    }
+}
+
 void BSpline::reduceDomain(std::vector<double> lb, std::vector<double> ub, bool doRegularizeKnotVectors)
 {
     if (lb.size() != numVariables || ub.size() != numVariables)
@@ -313,35 +515,29 @@ void BSpline::reduceDomain(std::vector<double> lb, std::vector<double> ub, bool
 
 void BSpline::globalKnotRefinement()
 {
-    // Compute knot insertion matrix
-    SparseMatrix A = basis.refineKnots();
+    // Compute univariate knot insertion matrices
+    std::vector<SparseMatrix> A = basis.refineKnots();
 
     // Update control points
-    assert(A.cols() == coefficients.cols());
-    coefficients = coefficients*A.transpose();
-    knotaverages = knotaverages*A.transpose();
+    transformControlPoints(A);
 }
 
 void BSpline::localKnotRefinement(DenseVector x)
 {
-    // Compute knot insertion matrix
-    SparseMatrix A = basis.refineKnotsLocally(x);
+    // Compute univariate knot insertion matrices
+    std::vector<SparseMatrix> A = basis.refineKnotsLocally(x);
 
     // Update control points
-    assert(A.cols() == coefficients.cols());
-    coefficients = coefficients*A.transpose();
-    knotaverages = knotaverages*A.transpose();
+    transformControlPoints(A);
 }
 
 void BSpline::decomposeToBezierForm()
 {
-    // Compute knot insertion matrix
-    SparseMatrix A = basis.decomposeToBezierForm();
+    // Compute univariate knot insertion matrices
+    std::vector<SparseMatrix> A = basis.decomposeToBezierForm();
 
     // Update control points
-    assert(A.cols() == coefficients.cols());
-    coefficients = coefficients*A.transpose();
-    knotaverages = knotaverages*A.transpose();
+    transformControlPoints(A);
 }
 
 // Computes knot averages: assumes that basis is initialized!
@@ -399,8 +595,97 @@ void BSpline::computeKnotAverages()
     assert(knotaverages.rows() == numVariables && knotaverages.cols() == basis.getNumBasisFunctions());
 }
 
+/*
+ * Computes the control points that interpolate the samples on a complete grid without
+ * forming the basis function matrix. With the samples and the coefficients both ordered
+ * with the last variable running fastest, the basis function matrix is the Kronecker
+ * product A_1 x ... x A_d of the univariate collocation matrices, so its inverse is applied
+ * as A_i^-1 along mode i of the sample tensor for each i. Each (banded) A_i is factorized
+ * once, and the total work is O(N*sum_i n_i*p_i) instead of a sparse solve of the N x N system.
+ * The knot averages are the Greville abscissae (B-splines reproduce linear functions).
+ * Returns false if the grid is incomplete or a collocation matrix is not square.
+ */
+bool BSpline::computeControlPointsKronecker(const DataTable &samples)
+{
+    if (!samples.isGridComplete())
+        return false;
+
+    std::vector<SparseMatrix> collocationMatrices;
+    computeCollocationMatrices(samples, collocationMatrices);
+
+    std::vector<unsigned int> dims;
+    for (auto &A : collocationMatrices)
+    {
+        if (A.rows() != A.cols())
+            return false;
+
+        dims.push_back(A.rows());
+    }
+
+    std::vector<double> y = samples.getVectorY();
+    DenseVector tensor = Eigen::Map<DenseVector>(y.data(), y.size());
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        DenseMatrix B, C;
+        unfoldTensor(tensor, dims, i, B);
+
+        SparseLUFactorization lu;
+        if (!lu.compute(collocationMatrices.at(i)) || !lu.solve(B, C))
+            return false;
+
+        foldTensor(C, dims, i, tensor);
+    }
+
+    coefficients = tensor.transpose();
+    computeKnotAverages();
+
+    return true;
+}
+
+/*
+ * Computes the univariate collocation matrices A_i(j,k) = B_k(x_j) of a complete grid,
+ * where x_j are the distinct sample values of variable i in increasing order
+ */
+void BSpline::computeCollocationMatrices(const DataTable &samples, std::vector<SparseMatrix> &matrices) const
+{
+    std::vector< std::vector<double> > table = samples.getTableX();
+
+    matrices.resize(numVariables);
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        std::vector<double> &x = table.at(i);
+        std::sort(x.begin(), x.end());
+        x.erase(std::unique(x.begin(), x.end()), x.end());
+
+        BSplineBasis1D basis1d = basis.getSingleBasis(i);
+        unsigned int degree = basis1d.getBasisDegree();
+
+        std::vector<Eigen::Triplet<double>> entries;
+        entries.reserve(x.size()*(degree+1));
+
+        std::vector<double> values(degree+1);
+        for (unsigned int j = 0; j < x.size(); j++)
+        {
+            int knotIndex = basis1d.evaluateNonZero(x.at(j), values.data());
+            for (unsigned int k = 0; k <= degree; k++)
+                entries.push_back(Eigen::Triplet<double>(j, knotIndex - degree + k, values.at(k)));
+        }
+
+        SparseMatrix &A = matrices.at(i);
+        A.resize(x.size(), basis1d.getNumBasisFunctions());
+        A.setFromTriplets(entries.begin(), entries.end());
+        A.makeCompressed();
+    }
+}
+
 void BSpline::computeControlPoints(const DataTable &samples)
 {
+    // On a complete grid, the equations are solved one variable at a time
+    if (computeControlPointsKronecker(samples))
+        return;
+
     /* Setup and solve equations Ac = b,
      * A = basis functions at sample x-values,
      * b = sample y-values when calculating control coefficients,
@@ -413,7 +698,11 @@ void BSpline::computeControlPoints(const DataTable &samples)
     DenseMatrix Bx, By;
     controlPointEquationRHS(samples, Bx, By);
 
-    DenseMatrix Cx, Cy;
+    // Both right-hand sides are solved with one factorization
+    DenseMatrix R(Bx.rows(), numVariables + 1);
+    R << Bx, By;
+
+    DenseMatrix C;
 
     int numEquations = A.rows();
     int maxNumEquations = pow(2,10);
@@ -427,7 +716,7 @@ void BSpline::computeControlPoints(const DataTable &samples)
 #endif // NDEBUG
 
         SparseLU s;
-        bool successfulSolve = (s.solve(A,Bx,Cx) && s.solve(A,By,Cy));
+        bool successfulSolve = s.solve(A,R,C);
 
         solveAsDense = !successfulSolve;
     }
@@ -440,15 +729,132 @@ void BSpline::computeControlPoints(const DataTable &samples)
 
         DenseMatrix Ad = A.toDense();
         DenseQR s;
-        bool successfulSolve = (s.solve(Ad,Bx,Cx) && s.solve(Ad,By,Cy));
+        bool successfulSolve = s.solve(Ad,R,C);
         if (!successfulSolve)
         {
             throw Exception("BSpline::computeControlPoints: Failed to solve for B-spline coefficients.");
         }
     }
 
-    coefficients = Cy.transpose();
-    knotaverages = Cx.transpose();
+    coefficients = C.rightCols(1).transpose();
+    knotaverages = C.leftCols(numVariables).transpose();
+}
+
+/*
+ * Multilevel B-spline approximation (Lee, Wolberg and Shin, Scattered data interpolation with
+ * multilevel B-splines, 1997). Level l is a B-spline with 2^l uniform knot intervals in each variable,
+ * fitted to the residuals of the previous levels by the basic approximation: each sample (x_c, r_c)
+ * proposes the coefficient phi_ck = w_ck*r_c/sum_j w_cj^2 for each of the basis functions with
+ * values w_ck at x_c, and coefficient k is the w_ck^2-weighted average of the proposals.
+ * Coefficients without proposals are zero. The sum of the levels is accumulated on the current
+ * lattice, which is refined to the next level by knot insertion (one variable at a time).
+ * Each level costs O(N*prod_i (p+1)) operations and no linear system is solved.
+ */
+void BSpline::computeMultilevelApproximation(const DataTable &samples, unsigned int degree, unsigned int numLevels)
+{
+    unsigned int numSamples = samples.getNumSamples();
+
+    // Copy the samples for random access, the residuals are updated after each level
+    DenseMatrix X(numVariables, numSamples);
+    DenseVector residuals(numSamples);
+    unsigned int j = 0;
+    for (auto it = samples.cbegin(); it != samples.cend(); ++it, ++j)
+    {
+        std::vector<double> x = it->getX();
+        for (unsigned int i = 0; i < numVariables; i++)
+            X(i,j) = x.at(i);
+        residuals(j) = it->getY();
+    }
+
+    // Coarsest level: one knot interval on the bounding box of the samples
+    std::vector< std::vector<double> > knotVectors;
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        double lb = X.row(i).minCoeff();
+        double ub = X.row(i).maxCoeff();
+        if (lb == ub)
+            throw Exception("BSpline::computeMultilevelApproximation: The samples must span an interval in each variable.");
+
+        std::vector<double> knots(degree+1, lb);
+        knots.insert(knots.end(), degree+1, ub);
+        knotVectors.push_back(knots);
+    }
+
+    std::vector<unsigned int> basisDegrees(numVariables, degree);
+    basis = BSplineBasis(knotVectors, basisDegrees, KnotVectorType::EXPLICIT);
+
+    if (!basis.fitsLocalBasis())
+        throw Exception("BSpline::computeMultilevelApproximation: Too many variables or too high basis degree.");
+
+    DenseVector tensor = DenseVector::Zero(basis.getNumBasisFunctions());
+
+    LocalBasis local;
+    std::vector<unsigned int> indices;
+    std::vector<double> values;
+
+    for (unsigned int level = 0; level < numLevels; level++)
+    {
+        if (level > 0)
+        {
+            // Refine the accumulated B-spline in place by inserting the midpoint of each knot interval
+            std::vector<unsigned int> dims;
+            for (unsigned int i = 0; i < numVariables; i++)
+            {
+                dims.push_back(basis.getNumBasisFunctions(i));
+                unsigned int numIntervals = dims.at(i) - degree;
+                basis.setNumBasisFunctionsTarget(i, dims.at(i) + numIntervals);
+            }
+
+            std::vector<SparseMatrix> A = basis.refineKnots();
+            for (unsigned int i = 0; i < numVariables; i++)
+                tensorModeProduct(A.at(i), dims, i, tensor);
+        }
+
+        // Basic approximation of the residuals
+        DenseVector delta = DenseVector::Zero(tensor.size());
+        DenseVector omega = DenseVector::Zero(tensor.size());
+
+        for (unsigned int c = 0; c < numSamples; c++)
+        {
+            basis.evalLocal(X.col(c), local);
+            basis.expandLocal(local, indices, values);
+
+            double sum = 0;
+            for (auto w : values)
+                sum += w*w;
+
+            for (unsigned int k = 0; k < values.size(); k++)
+            {
+                double w2 = values[k]*values[k];
+                delta(indices[k]) += w2*values[k]*residuals(c)/sum;
+                omega(indices[k]) += w2;
+            }
+        }
+
+        DenseVector phi = DenseVector::Zero(tensor.size());
+        for (unsigned int k = 0; k < phi.size(); k++)
+        {
+            if (omega(k) > 0)
+                phi(k) = delta(k)/omega(k);
+        }
+
+        tensor += phi;
+
+        // Residuals of the next level
+        for (unsigned int c = 0; c < numSamples; c++)
+        {
+            basis.evalLocal(X.col(c), local);
+            basis.expandLocal(local, indices, values);
+
+            double approximation = 0;
+            for (unsigned int k = 0; k < values.size(); k++)
+                approximation += values[k]*phi(indices[k]);
+            residuals(c) -= approximation;
+        }
+    }
+
+    coefficients = tensor.transpose();
+    computeKnotAverages();
 }
 
 void BSpline::computeBasisFunctionMatrix(const DataTable &samples, SparseMatrix &A) const
@@ -456,29 +862,49 @@ void BSpline::computeBasisFunctionMatrix(const DataTable &samples, SparseMatrix
     unsigned int numVariables = samples.getNumVariables();
     unsigned int numSamples = samples.getNumSamples();
 
-    int nnzPrCol = basis.supportedPrInterval();
+    int nnzPrRow = basis.supportedPrInterval();
 
     A.resize(numSamples, basis.getNumBasisFunctions());
-    A.reserve(DenseVector::Constant(numSamples, nnzPrCol)); // TODO: should reserve nnz per row!
+
+    std::vector< Eigen::Triplet<double> > entries;
+    entries.reserve(numSamples*nnzPrRow);
+
+    DenseVector xi(numVariables);
+    LocalBasis local;
+    std::vector<unsigned int> indices;
+    std::vector<double> values;
 
     int i = 0;
     for (auto it = samples.cbegin(); it != samples.cend(); ++it, ++i)
     {
-        DenseVector xi(numVariables);
         std::vector<double> xv = it->getX();
         for (unsigned int j = 0; j < numVariables; ++j)
         {
             xi(j) = xv.at(j);
         }
 
-        SparseVector basisValues = basis.eval(xi);
+        if (basis.fitsLocalBasis())
+        {
+            basis.evalLocal(xi, local);
+            basis.expandLocal(local, indices, values);
 
-        for (SparseVector::InnerIterator it2(basisValues); it2; ++it2)
+            for (unsigned int k = 0; k < indices.size(); ++k)
+            {
+                entries.push_back(Eigen::Triplet<double>(i, indices[k], values[k]));
+            }
+        }
+        else
         {
-            A.insert(i,it2.index()) = it2.value();
+            SparseVector basisValues = basis.eval(xi);
+
+            for (SparseVector::InnerIterator it2(basisValues); it2; ++it2)
+            {
+                entries.push_back(Eigen::Triplet<double>(i, it2.index(), it2.value()));
+            }
         }
     }
 
+    A.setFromTriplets(entries.begin(), entries.end());
     A.makeCompressed();
 }
 
@@ -506,13 +932,70 @@ void BSpline::controlPointEquationRHS(const DataTable &samples, DenseMatrix &Bx,
 
 void BSpline::insertKnots(double tau, unsigned int dim, unsigned int multiplicity)
 {
-    // Insert knots and compute knot insertion matrix
+    // Insert knots and compute the knot insertion matrix of variable dim
     SparseMatrix A = basis.insertKnots(tau, dim, multiplicity);
 
     // Update control points
-    assert(A.cols() == coefficients.cols());
-    coefficients = coefficients*A.transpose();
-    knotaverages = knotaverages*A.transpose();
+    std::vector<unsigned int> dims;
+    for (unsigned int i = 0; i < numVariables; i++)
+        dims.push_back(i == dim ? A.cols() : basis.getNumBasisFunctions(i));
+
+    transformControlPoints(A, dims, dim);
+}
+
+void BSpline::transformControlPoints(const std::vector<SparseMatrix> &A)
+{
+    assert(A.size() == numVariables);
+
+    std::vector<unsigned int> dims;
+    for (auto &Ai : A)
+        dims.push_back(Ai.cols());
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        // Skip variables that are left unchanged
+        const SparseMatrix &Ai = A.at(i);
+        bool identity = Ai.rows() == Ai.cols() && Ai.nonZeros() == Ai.rows();
+        for (int k = 0; identity && k < Ai.outerSize(); k++)
+            for (SparseMatrix::InnerIterator it(Ai, k); it; ++it)
+                identity = identity && it.row() == it.col() && it.value() == 1;
+
+        if (identity)
+            continue;
+
+        transformControlPoints(Ai, dims, i);
+        dims.at(i) = Ai.rows();
+    }
+}
+
+void BSpline::transformControlPoints(const SparseMatrix &A, const std::vector<unsigned int> &dims, unsigned int dim)
+{
+    assert(A.cols() == dims.at(dim));
+
+    unsigned int numCoefficients = coefficients.cols()/A.cols()*A.rows();
+    assert(coefficients.cols() % A.cols() == 0);
+
+    DenseMatrix newCoefficients(coefficients.rows(), numCoefficients);
+    DenseMatrix newKnotaverages(knotaverages.rows(), numCoefficients);
+
+    for (int r = 0; r < coefficients.rows(); r++)
+    {
+        std::vector<unsigned int> newDims(dims);
+        DenseVector tensor = coefficients.row(r).transpose();
+        tensorModeProduct(A, newDims, dim, tensor);
+        newCoefficients.row(r) = tensor.transpose();
+    }
+
+    for (int r = 0; r < knotaverages.rows(); r++)
+    {
+        std::vector<unsigned int> newDims(dims);
+        DenseVector tensor = knotaverages.row(r).transpose();
+        tensorModeProduct(A, newDims, dim, tensor);
+        newKnotaverages.row(r) = tensor.transpose();
+    }
+
+    coefficients = newCoefficients;
+    knotaverages = newKnotaverages;
 }
 
 void BSpline::regularizeKnotVectors(std::vector<double> &lb, std::vector<double> &ub)
@@ -526,11 +1009,6 @@ void BSpline::regularizeKnotVectors(std::vector<double> &lb, std::vector<double>
         unsigned int multiplicityTarget = basis.getBasisDegree(dim) + 1;
 
         // Inserting many knots at the time (to save number of B-spline coefficient calculations)
-        // NOTE: This method generates knot insertion matrices with more nonzero elements than
-        // the method that inserts one knot at the time. This causes the preallocation of
-        // kronecker product matrices to become too small and the speed deteriorates drastically
-        // in higher dimensions because reallocation is necessary. This can be prevented by
-        // precomputing the number of nonzeros when preallocating memory (see myKroneckerProduct).
         int numKnotsLB = multiplicityTarget - basis.getKnotMultiplicity(dim, lb.at(dim));
         if (numKnotsLB > 0)
         {
@@ -550,20 +1028,183 @@ bool BSpline::removeUnsupportedBasisFunctions(std::vector<double> &lb, std::vect
     assert(lb.size() == numVariables);
     assert(ub.size() == numVariables);
 
-    SparseMatrix A;
-    if (!basis.reduceSupport(lb, ub, A))
-        return false;
+    std::vector<unsigned int> oldDims = getNumBasisFunctions();
 
-    if (coefficients.cols() != A.rows())
+    std::vector<unsigned int> first;
+    if (!basis.reduceSupport(lb, ub, first))
         return false;
 
-    // Remove unsupported control points (basis functions)
-    coefficients = coefficients*A;
-    knotaverages = knotaverages*A;
+    std::vector<unsigned int> dims = getNumBasisFunctions();
+
+    unsigned int numCoefficients = 1;
+    for (auto n : dims)
+        numCoefficients *= n;
+
+    // Remove unsupported control points (basis functions) by slicing the coefficient tensor.
+    // Runs along the last variable are contiguous, so they are copied as blocks.
+    unsigned int last = numVariables - 1;
+    unsigned int run = dims.at(last);
+
+    DenseMatrix newCoefficients(coefficients.rows(), numCoefficients);
+    DenseMatrix newKnotaverages(knotaverages.rows(), numCoefficients);
+    std::vector<unsigned int> index(numVariables, 0);
+
+    for (unsigned int k = 0; k < numCoefficients; k += run)
+    {
+        unsigned int oldIndex = 0;
+        for (unsigned int i = 0; i < numVariables; i++)
+            oldIndex = oldIndex*oldDims.at(i) + first.at(i) + index.at(i);
+
+        newCoefficients.middleCols(k, run) = coefficients.middleCols(oldIndex, run);
+        newKnotaverages.middleCols(k, run) = knotaverages.middleCols(oldIndex, run);
+
+        // Next run (the last variable is covered by the run itself)
+        for (int i = (int)last - 1; i >= 0; i--)
+        {
+            if (++index.at(i) < dims.at(i))
+                break;
+            index.at(i) = 0;
+        }
+    }
+
+    coefficients = newCoefficients;
+    knotaverages = newKnotaverages;
 
     return true;
 }
 
+void BSpline::bounds(const std::vector<double> &lb, const std::vector<double> &ub,
+                     double &lower, double &upper, bool tight) const
+{
+    if (lb.size() != numVariables || ub.size() != numVariables)
+        throw Exception("BSpline::bounds: Inconsistent vector sizes!");
+
+    std::vector<double> sl = basis.getSupportLowerBound();
+    std::vector<double> su = basis.getSupportUpperBound();
+
+    for (unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        if (ub.at(dim) <= lb.at(dim) || lb.at(dim) < sl.at(dim) || ub.at(dim) > su.at(dim))
+            throw Exception("BSpline::bounds: The box must be a nonempty subset of the domain!");
+    }
+
+    if (tight)
+    {
+        BSpline box = sliceDomain(lb, ub, true);
+        box.decomposeToBezierForm();
+
+        lower = box.coefficients.minCoeff();
+        upper = box.coefficients.maxCoeff();
+        return;
+    }
+
+    std::vector<unsigned int> first, last;
+    basis.indexSupportedBasisfunctions(lb, ub, first, last);
+
+    std::vector<unsigned int> dims = getNumBasisFunctions();
+
+    // Visit the supported coefficients one run along the last variable at a time
+    unsigned int n = numVariables - 1;
+    unsigned int run = last.at(n) - first.at(n) + 1;
+    std::vector<unsigned int> index(first);
+
+    lower = std::numeric_limits<double>::max();
+    upper = -std::numeric_limits<double>::max();
+
+    while (true)
+    {
+        unsigned int k = 0;
+        for (unsigned int i = 0; i < numVariables; i++)
+            k = k*dims.at(i) + index.at(i);
+
+        lower = std::min(lower, coefficients.middleCols(k, run).minCoeff());
+        upper = std::max(upper, coefficients.middleCols(k, run).maxCoeff());
+
+        int i = (int)n - 1;
+        for (; i >= 0; i--)
+        {
+            if (++index.at(i) <= last.at(i))
+                break;
+            index.at(i) = first.at(i);
+        }
+
+        if (i < 0)
+            break;
+    }
+}
+
+/*
+ * The supported coefficients are copied to a B-spline with the knots t_first,...,t_(last+p+1),
+ * padded with copies of the end knots to make the knot vectors regular. The basis functions added by
+ * the padding vanish on [lb, ub] and get zero coefficients. reduceDomain then inserts knots
+ * at the bounds and removes the padding.
+ */
+BSpline BSpline::sliceDomain(const std::vector<double> &lb, const std::vector<double> &ub, bool doRegularizeKnotVectors) const
+{
+    std::vector<unsigned int> first, last;
+    basis.indexSupportedBasisfunctions(lb, ub, first, last);
+
+    std::vector<unsigned int> degrees = getBasisDegrees();
+    std::vector<unsigned int> oldDims = getNumBasisFunctions();
+    std::vector< std::vector<double> > knotVectors;
+    std::vector<unsigned int> numBasisFunctions, padding;
+    unsigned int numCoefficients = 1;
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        std::vector<double> knots = basis.getKnotVector(i);
+        unsigned int p = degrees.at(i);
+
+        std::vector<double> slice(knots.begin() + first.at(i), knots.begin() + last.at(i) + p + 2);
+
+        unsigned int front = p + 1 - std::count(slice.begin(), slice.begin() + p + 1, slice.front());
+        unsigned int back = p + 1 - std::count(slice.end() - p - 1, slice.end(), slice.back());
+        slice.insert(slice.begin(), front, slice.front());
+        slice.insert(slice.end(), back, slice.back());
+
+        knotVectors.push_back(slice);
+        numBasisFunctions.push_back(last.at(i) - first.at(i) + 1);
+        padding.push_back(front);
+        numCoefficients *= slice.size() - p - 1;
+    }
+
+    BSpline reduced(std::vector<double>(numCoefficients, 0), knotVectors, degrees);
+    std::vector<unsigned int> dims = reduced.getNumBasisFunctions();
+
+    // Copy the supported coefficients and knot averages, one run along the last variable at a time
+    unsigned int n = numVariables - 1;
+    unsigned int run = numBasisFunctions.at(n);
+    std::vector<unsigned int> index(numVariables, 0);
+
+    unsigned int numRuns = 1;
+    for (unsigned int i = 0; i < n; i++)
+        numRuns *= numBasisFunctions.at(i);
+
+    for (unsigned int k = 0; k < numRuns; k++)
+    {
+        unsigned int oldIndex = 0, newIndex = 0;
+        for (unsigned int i = 0; i < numVariables; i++)
+        {
+            oldIndex = oldIndex*oldDims.at(i) + first.at(i) + index.at(i);
+            newIndex = newIndex*dims.at(i) + padding.at(i) + index.at(i);
+        }
+
+        reduced.coefficients.middleCols(newIndex, run) = coefficients.middleCols(oldIndex, run);
+        reduced.knotaverages.middleCols(newIndex, run) = knotaverages.middleCols(oldIndex, run);
+
+        for (int i = (int)n - 1; i >= 0; i--)
+        {
+            if (++index.at(i) < numBasisFunctions.at(i))
+                break;
+            index.at(i) = 0;
+        }
+    }
+
+    reduced.reduceDomain(lb, ub, doRegularizeKnotVectors);
+
+    return reduced;
+}
+
 void BSpline::save(const std::string fileName) const
 {
     // Serialize
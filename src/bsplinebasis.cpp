@@ -52,6 +52,24 @@ void BSplineBasis::setUnivariateBases(std::vector< std::vector<double> > &X, std
 
 SparseVector BSplineBasis::eval(const DenseVector &x) const
 {
+    if (fitsLocalBasis())
+    {
+        LocalBasis local;
+        evalLocal(x, local);
+
+        std::vector<unsigned int> indices;
+        std::vector<double> values;
+        expandLocal(local, indices, values);
+
+        // Indices are increasing, so the values are appended
+        SparseVector tensorvalues(getNumBasisFunctions());
+        tensorvalues.reserve(indices.size());
+        for (unsigned int i = 0; i < indices.size(); i++)
+            tensorvalues.insert(indices[i]) = values[i];
+
+        return tensorvalues;
+    }
+
     // Evaluate basisfunctions for each variable i and compute the tensor product of the function values
     std::vector<SparseVector> basisFunctionValues;
 
@@ -61,8 +79,113 @@ SparseVector BSplineBasis::eval(const DenseVector &x) const
     return foldlKroneckerProductVectors(basisFunctionValues);
 }
 
+/*
+ * Evaluates the nonzero basis functions in each variable at x without allocating memory.
+ * If numDerivatives > 0, the derivatives up to that order are computed in the same pass.
+ * The tensor product of the univariate values is not formed; it is left to the caller
+ * to contract the values against the supported coefficients.
+ * Requires that fitsLocalBasis() is true.
+ */
+void BSplineBasis::evalLocal(const DenseVector &x, LocalBasis &local, unsigned int numDerivatives) const
+{
+    assert(fitsLocalBasis());
+    assert(numDerivatives <= MAX_LOCAL_DERIVATIVE_ORDER);
+
+    local.numVariables = numVariables;
+    local.numDerivatives = numDerivatives;
+
+    for (unsigned int var = 0; var < numVariables; var++)
+    {
+        const BSplineBasis1D &basis = bases[var];
+        unsigned int degree = basis.getBasisDegree();
+
+        int knotIndex;
+        if (numDerivatives == 0)
+            knotIndex = basis.evaluateNonZero(x(var), local.values[var][0]);
+        else
+            knotIndex = basis.evaluateNonZeroDerivatives(x(var), numDerivatives, local.values[var][0], MAX_LOCAL_DEGREE+1);
+
+        local.numBasisFunctions[var] = basis.getNumBasisFunctions();
+        local.first[var] = knotIndex - degree;
+        local.size[var] = degree + 1;
+    }
+}
+
+/*
+ * Sets up a block for the vectorized batch kernels (see bsplinesimd.h).
+ * The coefficients and the points are set by the caller.
+ * Requires that fitsSimdBlock() is true.
+ */
+void BSplineBasis::initSimdBlock(SimdBlock &block) const
+{
+    assert(fitsSimdBlock());
+
+    block.numVariables = numVariables;
+    block.degree = bases.at(0).getBasisDegree();
+
+    for (unsigned int var = 0; var < numVariables; var++)
+    {
+        block.knots[var] = bases[var].getKnotData();
+        block.numBasisFunctions[var] = bases[var].getNumBasisFunctions();
+    }
+}
+
+/*
+ * Stores x in the given lane of the block together with the knot interval index in each variable.
+ */
+void BSplineBasis::setSimdBlockPoint(SimdBlock &block, unsigned int lane, const DenseVector &x) const
+{
+    for (unsigned int var = 0; var < numVariables; var++)
+    {
+        double xi = x(var);
+        bases[var].supportHack(xi);
+
+        block.x[var*SIMD_BLOCK_SIZE + lane] = xi;
+        block.span[var*SIMD_BLOCK_SIZE + lane] = bases[var].indexHalfopenInterval(xi);
+    }
+}
+
+/*
+ * Expands the local basis into the (p+1)^n nonzero tensor product basis function values
+ * and their indices. The indices are returned in increasing order (the same order as
+ * the Kronecker product of the univariate basis function vectors).
+ */
+void BSplineBasis::expandLocal(const LocalBasis &local, std::vector<unsigned int> &indices, std::vector<double> &values) const
+{
+    unsigned int total = 1;
+    for (unsigned int dim = 0; dim < local.numVariables; dim++)
+        total *= local.size[dim];
+
+    indices.resize(total);
+    values.resize(total);
+
+    indices[0] = 0;
+    values[0] = 1;
+
+    unsigned int count = 1;
+    for (unsigned int dim = 0; dim < local.numVariables; dim++)
+    {
+        unsigned int size = local.size[dim];
+
+        // Expand in place, starting from the back so that no entry is overwritten before it is read
+        for (unsigned int j = count; j-- > 0;)
+        {
+            unsigned int index = indices[j]*local.numBasisFunctions[dim] + local.first[dim];
+            double value = values[j];
+
+            for (unsigned int k = size; k-- > 0;)
+            {
+                indices[j*size+k] = index + k;
+                values[j*size+k] = value*local.values[dim][0][k];
+            }
+        }
+
+        count *= size;
+    }
+}
+
 // Old implementation of Jacobian
-DenseMatrix BSplineBasis::evalBasisJacobianOld(DenseVector &x) const
+DenseMatrix BSplineBasis::evalBasisJacobianOld(const DenseVector &x) const
 {
     // Jacobian basis matrix
     DenseMatrix J; J.setZero(getNumBasisFunctions(), numVariables);
@@ -97,7 +220,7 @@ DenseMatrix BSplineBasis::evalBasisJacobianOld(DenseVector &x) const
     return J;
 }
 
-SparseMatrix BSplineBasis::evalBasisJacobian(DenseVector &x) const
+SparseMatrix BSplineBasis::evalBasisJacobian(const DenseVector &x) const
 {
     // Jacobian basis matrix
     SparseMatrix J(getNumBasisFunctions(), numVariables);
@@ -143,7 +266,7 @@ SparseMatrix BSplineBasis::evalBasisJacobian(DenseVector &x) const
     return J;
 }
 
-SparseMatrix BSplineBasis::evalBasisJacobian2(DenseVector &x) const
+SparseMatrix BSplineBasis::evalBasisJacobian2(const DenseVector &x) const
 {
     // Jacobian basis matrix
     SparseMatrix J(getNumBasisFunctions(), numVariables);
@@ -181,7 +304,7 @@ SparseMatrix BSplineBasis::evalBasisJacobian2(DenseVector &x) const
     return J;
 }
 
-SparseMatrix BSplineBasis::evalBasisHessian(DenseVector &x) const
+SparseMatrix BSplineBasis::evalBasisHessian(const DenseVector &x) const
 {
     // Hessian basis matrix
     /* Hij = B1 x ... x DBi x ... x DBj x ... x Bn
@@ -248,117 +371,68 @@ SparseMatrix BSplineBasis::evalBasisHessian(DenseVector &x) const
 
 SparseMatrix BSplineBasis::insertKnots(double tau, unsigned int dim, unsigned int multiplicity)
 {
-    SparseMatrix A(1,1);
-//    A.resize(1,1);
-    A.insert(0,0) = 1;
-
-    // Calculate multivariate knot insertion matrix
-    for (unsigned int i = 0; i < numVariables; i++)
-    {
-        SparseMatrix temp = A;
-        SparseMatrix Ai;
+    if (dim >= numVariables)
+        throw Exception("BSplineBasis::insertKnots: Invalid variable.");
 
-        if (i == dim)
-        {
-            // Build knot insertion matrix
-            Ai = bases.at(i).insertKnots(tau, multiplicity);
-        }
-        else
-        {
-            // No insertion - identity matrix
-            int m = bases.at(i).getNumBasisFunctions();
-            Ai.resize(m,m);
-            Ai.setIdentity();
-        }
+    // Only variable dim changes, so the univariate knot insertion matrix is all that is needed
+    return bases.at(dim).insertKnots(tau, multiplicity);
+}
 
-        //A = kroneckerProduct(temp, Ai);
-        myKroneckerProduct(temp, Ai, A);
-    }
+std::vector<SparseMatrix> BSplineBasis::refineKnots()
+{
+    std::vector<SparseMatrix> A;
 
-    A.makeCompressed();
+    for (unsigned int i = 0; i < numVariables; i++)
+        A.push_back(bases.at(i).refineKnots());
 
     return A;
 }
 
-SparseMatrix BSplineBasis::refineKnots()
+std::vector<SparseMatrix> BSplineBasis::refineKnotsLocally(DenseVector x)
 {
-    SparseMatrix A(1,1);
-    A.insert(0,0) = 1;
+    std::vector<SparseMatrix> A;
 
     for (unsigned int i = 0; i < numVariables; i++)
-    {
-        SparseMatrix temp = A;
-        SparseMatrix Ai = bases.at(i).refineKnots();
-
-        //A = kroneckerProduct(temp, Ai);
-        myKroneckerProduct(temp, Ai, A);
-    }
-
-    A.makeCompressed();
+        A.push_back(bases.at(i).refineKnotsLocally(x(i)));
 
     return A;
 }
 
-SparseMatrix BSplineBasis::refineKnotsLocally(DenseVector x)
+std::vector<SparseMatrix> BSplineBasis::decomposeToBezierForm()
 {
-    SparseMatrix A(1,1);
-    A.insert(0,0) = 1;
+    std::vector<SparseMatrix> A;
 
     for (unsigned int i = 0; i < numVariables; i++)
-    {
-        SparseMatrix temp = A;
-        SparseMatrix Ai = bases.at(i).refineKnotsLocally(x(i));
-
-        //A = kroneckerProduct(temp, Ai);
-        myKroneckerProduct(temp, Ai, A);
-    }
-
-    A.makeCompressed();
+        A.push_back(bases.at(i).decomposeToBezierForm());
 
     return A;
 }
 
-SparseMatrix BSplineBasis::decomposeToBezierForm()
+void BSplineBasis::indexSupportedBasisfunctions(const std::vector<double> &lb, const std::vector<double> &ub,
+                                                std::vector<unsigned int> &first, std::vector<unsigned int> &last) const
 {
-    SparseMatrix A(1,1);
-    A.insert(0,0) = 1;
+    assert(lb.size() == numVariables && ub.size() == numVariables);
 
-    for (unsigned int i = 0; i < numVariables; i++)
-    {
-        SparseMatrix temp = A;
-        SparseMatrix Ai = bases.at(i).decomposeToBezierForm();
-
-        //A = kroneckerProduct(temp, Ai);
-        myKroneckerProduct(temp, Ai, A);
-    }
+    first.resize(numVariables);
+    last.resize(numVariables);
 
-    A.makeCompressed();
-
-    return A;
+    for (unsigned int i = 0; i < numVariables; i++)
+        bases.at(i).indexSupportedBasisfunctions(lb.at(i), ub.at(i), first.at(i), last.at(i));
 }
 
-bool BSplineBasis::reduceSupport(std::vector<double>& lb, std::vector<double>& ub, SparseMatrix &A)
+bool BSplineBasis::reduceSupport(std::vector<double>& lb, std::vector<double>& ub, std::vector<unsigned int> &first)
 {
     assert(lb.size() == ub.size());
     assert(lb.size() == numVariables);
 
-    A.resize(1,1);
-    A.insert(0,0) = 1;
+    first.resize(numVariables);
 
     for (unsigned int i = 0; i < numVariables; i++)
     {
-        SparseMatrix temp = A;
-        SparseMatrix Ai;
-
-        if (!bases.at(i).reduceSupport(lb.at(i), ub.at(i), Ai))
+        if (!bases.at(i).reduceSupport(lb.at(i), ub.at(i), first.at(i)))
             return false;
-
-        //A = kroneckerProduct(temp, Ai);
-        myKroneckerProduct(temp, Ai, A);
     }
 
-    A.makeCompressed();
-
     return true;
 }
 
@@ -442,7 +516,7 @@ unsigned int BSplineBasis::getNumBasisFunctions() const
     return prod;
 }
 
-BSplineBasis1D BSplineBasis::getSingleBasis(int dim)
+BSplineBasis1D BSplineBasis::getSingleBasis(int dim) const
 {
     return bases.at(dim);
 }
@@ -485,6 +559,11 @@ std::vector<unsigned int> BSplineBasis::getNumBasisFunctionsTarget() const
     return ret;
 }
 
+void BSplineBasis::setNumBasisFunctionsTarget(unsigned int dim, unsigned int target)
+{
+    bases.at(dim).setNumBasisFunctionsTarget(target);
+}
+
 int BSplineBasis::supportedPrInterval() const
 {
     int ret = 1;
@@ -495,7 +574,41 @@ int BSplineBasis::supportedPrInterval() const
     return ret;
 }
 
-bool BSplineBasis::insideSupport(DenseVector &x) const
+// Returns true if the basis can be evaluated with the fixed-size LocalBasis workspace
+bool BSplineBasis::fitsLocalBasis() const
+{
+    if (numVariables > MAX_LOCAL_NUM_VARIABLES)
+        return false;
+
+    for (unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        if (bases.at(dim).getBasisDegree() > MAX_LOCAL_DEGREE)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * The vectorized batch kernels require the same degree, between 1 and SIMD_MAX_DEGREE, in all variables
+ */
+bool BSplineBasis::fitsSimdBlock() const
+{
+    if (numVariables > SIMD_MAX_NUM_VARIABLES)
+        return false;
+
+    unsigned int degree = bases.at(0).getBasisDegree();
+    if (degree < 1 || degree > SIMD_MAX_DEGREE)
+        return false;
+
+    for (unsigned int dim = 1; dim < numVariables; dim++)
+    {
+        if (bases.at(dim).getBasisDegree() != degree)
+            return false;
+    }
+    return true;
+}
+
+bool BSplineBasis::insideSupport(const DenseVector &x) const
 {
     if (x.size() != numVariables)
     {
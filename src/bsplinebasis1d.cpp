@@ -10,10 +10,59 @@
 #include "bsplinebasis1d.h"
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 
 namespace SPLINTER
 {
 
+/*
+ * Uniform B-spline basis matrices in power form, scaled by p!.
+ * On a span t_u <= x < t_(u+1) where the knots t_(u-p+1),...,t_(u+p) have spacing h,
+ * basis function u-p+k equals sum_j M[k][j]*s^j/p!, where s = (x - t_u)/h.
+ */
+constexpr double UNIFORM_BASIS_1[2*2] = {
+    1, -1,
+    0,  1
+};
+
+constexpr double UNIFORM_BASIS_2[3*3] = {
+    1, -2,  1,
+    1,  2, -2,
+    0,  0,  1
+};
+
+constexpr double UNIFORM_BASIS_3[4*4] = {
+    1, -3,  3, -1,
+    4,  0, -6,  3,
+    1,  3,  3, -3,
+    0,  0,  0,  1
+};
+
+constexpr double UNIFORM_BASIS_4[5*5] = {
+     1,  -4,  6,  -4,  1,
+    11, -12, -6,  12, -4,
+    11,  12, -6, -12,  6,
+     1,   4,  6,   4, -4,
+     0,   0,  0,   0,  1
+};
+
+constexpr double UNIFORM_BASIS_5[6*6] = {
+     1,  -5,  10, -10,   5,  -1,
+    26, -50,  20,  20, -20,   5,
+    66,   0, -60,   0,  30, -10,
+    26,  50,  20, -20, -20,  10,
+     1,   5,  10,  10,   5,  -5,
+     0,   0,   0,   0,   0,   1
+};
+
+constexpr const double *UNIFORM_BASIS[MAX_UNIFORM_DEGREE+1] = {
+    nullptr, UNIFORM_BASIS_1, UNIFORM_BASIS_2, UNIFORM_BASIS_3, UNIFORM_BASIS_4, UNIFORM_BASIS_5
+};
+
+constexpr double UNIFORM_BASIS_SCALE[MAX_UNIFORM_DEGREE+1] = {
+    1, 1, 1.0/2, 1.0/6, 1.0/24, 1.0/120
+};
+
 BSplineBasis1D::BSplineBasis1D(std::vector<double> &x, unsigned int degree)
     : BSplineBasis1D(x, degree, KnotVectorType::FREE)
 {
@@ -51,127 +100,281 @@ BSplineBasis1D::BSplineBasis1D(std::vector<double> &x, unsigned int degree, Knot
     // NOTE: this exception is too strict (multiple start and end knots should not be required)
     if (!isKnotVectorRegular())
         throw Exception("BSplineBasis1D::BSplineBasis1D: Knot vector is not regular.");
+
+    updateUniformKnots();
 }
 
 SparseVector BSplineBasis1D::evaluate(double x) const
 {
     SparseVector basisvalues(getNumBasisFunctions());
 
-    supportHack(x);
-
-    std::vector<int> indexSupported = indexSupportedBasisfunctions(x);
+    std::vector<double> values(degree+1);
+    int knotIndex = evaluateNonZero(x, values.data());
 
-    basisvalues.reserve(indexSupported.size());
+    basisvalues.reserve(degree+1);
 
-    // Iterate through the nonzero basisfunctions and store functionvalues
-    for (auto it = indexSupported.begin(); it != indexSupported.end(); ++it)
+    // Store the nonzero function values
+    for (unsigned int k = 0; k <= degree; k++)
     {
-        basisvalues.insert(*it) = deBoorCox(x, *it, degree);
+        basisvalues.insert(knotIndex-degree+k) = values.at(k);
     }
 
-    // Alternative evaluation using basis matrix
-//    int knotIndex = indexHalfopenInterval(x); // knot index
-
-//    SparseMatrix basisvalues2 = buildBsplineMatrix(x, knotIndex, 1);
-//    for (int i = 2; i <= basisDegree; i++)
-//    {
-//        SparseMatrix Ri = buildBsplineMatrix(x, knotIndex, i);
-//        basisvalues2 = basisvalues2*Ri;
-//    }
-//    basisvalues2.makeCompressed();
-
-//    assert(basisvalues2.rows() == 1);
-//    assert(basisvalues2.cols() == basisDegree + 1);
-
     return basisvalues;
 }
 
-SparseVector BSplineBasis1D::evaluateDerivative(double x, int r) const
+/*
+ * Evaluates the degree+1 basis functions that are nonzero at x and writes them to values,
+ * which must have room for degree+1 elements. Returns the knot span index u, so that
+ * values[k] is the value of basis function u-degree+k. No memory is allocated.
+ *
+ * The values are computed in a single O(p^2) pass by building the triangular table of
+ * the Cox-de Boor recursion in place (algorithm A2.2 in Piegl and Tiller, The NURBS Book).
+ * Since t_u < t_(u+1), none of the denominators vanish. On spans with uniform knots,
+ * the precomputed uniform basis matrix is used instead.
+ */
+int BSplineBasis1D::evaluateNonZero(double x, double *values) const
 {
-    // Evaluate rth derivative of basis functions at x
-    // Returns vector [D^(r)B_(u-p,p)(x) ... D^(r)B_(u,p)(x)]
-    // where u is the knot index and p is the degree
-    int p = degree;
+    supportHack(x);
+
+    int u = indexHalfopenInterval(x);
+
+    if (isUniformSpan(u))
+    {
+        evaluateUniform(x, u, values);
+        return u;
+    }
+
+    const double *t = knots.data();
 
-    // Continuity requirement
-    //assert(p > r);
-    if (p <= r)
+    values[0] = 1;
+
+    for (unsigned int j = 1; j <= degree; j++)
     {
-        // Return zero-gradient
-        SparseVector DB(getNumBasisFunctions());
-        return DB;
+        double saved = 0;
+        for (unsigned int r = 0; r < j; r++)
+        {
+            double right = t[u+r+1] - x;
+            double left = x - t[u+r+1-j];
+            double temp = values[r]/(right + left);
+            values[r] = saved + right*temp;
+            saved = left*temp;
+        }
+        values[j] = saved;
     }
 
-    // Check for knot multiplicity here!
+    return u;
+}
 
+/*
+ * Evaluates the nonzero basis functions and their derivatives up to order n at x.
+ * Row k of the output, starting at derivatives[k*stride], holds the kth derivative of
+ * basis functions u-degree,...,u, where u is the returned knot span index. Row 0 holds
+ * the function values, and derivatives of order higher than the degree are zero.
+ *
+ * All orders are computed in one pass from the triangular table of the Cox-de Boor
+ * recursion (algorithm A2.3 in Piegl and Tiller, The NURBS Book). The table is kept
+ * on the stack for degrees up to MAX_LOCAL_DEGREE. On spans with uniform knots,
+ * the derivatives of the uniform basis polynomials are evaluated instead.
+ */
+int BSplineBasis1D::evaluateNonZeroDerivatives(double x, unsigned int n, double *derivatives, unsigned int stride) const
+{
     supportHack(x);
 
-    int knotIndex = indexHalfopenInterval(x);
+    int u = indexHalfopenInterval(x);
+
+    if (isUniformSpan(u))
+    {
+        evaluateUniformDerivatives(x, u, n, derivatives, stride);
+        return u;
+    }
+
+    const double *t = knots.data();
+    unsigned int p = degree;
+    unsigned int m = p + 1;
 
-    // Algorithm 3.18 from Lyche and Moerken (2011)
-    SparseMatrix B(1,1);
-    B.insert(0,0) = 1;
+    // Triangular table: basis functions in the upper triangle and knot differences in the lower triangle
+    double nduFixed[(MAX_LOCAL_DEGREE+1)*(MAX_LOCAL_DEGREE+1)];
+    double aFixed[2*(MAX_LOCAL_DEGREE+1)];
+    std::vector<double> nduDynamic, aDynamic;
 
-    for (int i = 1; i <= p-r; i++)
+    double *ndu = nduFixed;
+    double *a = aFixed;
+    if (p > MAX_LOCAL_DEGREE)
     {
-        SparseMatrix R = buildBasisMatrix(x, knotIndex, i);
-        B = B*R;
+        nduDynamic.resize(m*m);
+        aDynamic.resize(2*m);
+        ndu = nduDynamic.data();
+        a = aDynamic.data();
     }
 
-    for (int i = p-r+1; i <= p; i++)
+    ndu[0] = 1;
+    for (unsigned int j = 1; j <= p; j++)
     {
-        SparseMatrix DR = buildBasisMatrix(x, knotIndex, i, true);
-        B = B*DR;
+        double saved = 0;
+        for (unsigned int r = 0; r < j; r++)
+        {
+            double right = t[u+r+1] - x;
+            double left = x - t[u+r+1-j];
+
+            ndu[j*m+r] = right + left;
+            double temp = ndu[r*m+j-1]/ndu[j*m+r];
+
+            ndu[r*m+j] = saved + right*temp;
+            saved = left*temp;
+        }
+        ndu[j*m+j] = saved;
     }
-    double factorial = std::tgamma(p+1)/std::tgamma(p-r+1);
-    B = B*factorial;
 
-    assert(B.cols() == p+1);
+    for (unsigned int j = 0; j <= p; j++)
+        derivatives[j] = ndu[j*m+p];
 
-    // From row vector to extended column vector
-    SparseVector DB(getNumBasisFunctions());
-    DB.reserve(p+1);
-    int i = knotIndex-p; // First insertion index
-    for (int k = 0; k < B.outerSize(); ++k)
-    for (SparseMatrix::InnerIterator it(B,k); it; ++it)
+    // Derivatives of order higher than the degree vanish
+    for (unsigned int k = p+1; k <= n; k++)
+        for (unsigned int j = 0; j <= p; j++)
+            derivatives[k*stride+j] = 0;
+
+    unsigned int nmax = std::min(n, p);
+
+    for (int r = 0; r <= (int)p; r++)
     {
-        DB.insert(i+it.col()) = it.value();
+        // Alternate between the two rows of a
+        double *a1 = a;
+        double *a2 = a + m;
+        a1[0] = 1;
+
+        for (int k = 1; k <= (int)nmax; k++)
+        {
+            double d = 0;
+            int rk = r - k;
+            int pk = p - k;
+
+            if (r >= k)
+            {
+                a2[0] = a1[0]/ndu[(pk+1)*m+rk];
+                d = a2[0]*ndu[rk*m+pk];
+            }
+
+            int j1 = (rk >= -1) ? 1 : -rk;
+            int j2 = (r-1 <= pk) ? k-1 : p-r;
+
+            for (int j = j1; j <= j2; j++)
+            {
+                a2[j] = (a1[j] - a1[j-1])/ndu[(pk+1)*m+rk+j];
+                d += a2[j]*ndu[(rk+j)*m+pk];
+            }
+
+            if (r <= pk)
+            {
+                a2[k] = -a1[k-1]/ndu[(pk+1)*m+r];
+                d += a2[k]*ndu[r*m+pk];
+            }
+
+            derivatives[k*stride+r] = d;
+            std::swap(a1, a2);
+        }
     }
 
-    return DB;
+    // Multiply by the factors p!/(p-k)!
+    double factor = p;
+    for (unsigned int k = 1; k <= nmax; k++)
+    {
+        for (unsigned int j = 0; j <= p; j++)
+            derivatives[k*stride+j] *= factor;
+        factor *= (p-k);
+    }
+
+    return u;
 }
 
-// Old implementation of first derivative of basis functions
-SparseVector BSplineBasis1D::evaluateFirstDerivative(double x) const
+/*
+ * Evaluates the nonzero basis functions on a span with uniform knots (see isUniformSpan)
+ * as polynomials in the local coordinate s = (x - t_u)/h, using Horner's scheme.
+ * No divisions are performed.
+ */
+void BSplineBasis1D::evaluateUniform(double x, int u, double *values) const
 {
-    SparseVector values(getNumBasisFunctions());
+    const double *M = UNIFORM_BASIS[degree];
+    double s = (x - knots[u])*uniformInverseSpacing;
+    double scale = UNIFORM_BASIS_SCALE[degree];
 
-    supportHack(x);
+    for (unsigned int k = 0; k <= degree; k++)
+    {
+        const double *row = M + k*(degree+1);
+        double value = row[degree];
+        for (int j = degree-1; j >= 0; j--)
+            value = value*s + row[j];
+        values[k] = scale*value;
+    }
+}
 
-    std::vector<int> supportedBasisFunctions = indexSupportedBasisfunctions(x);
+/*
+ * Evaluates the nonzero basis functions and their derivatives up to order n on a span
+ * with uniform knots. The rth derivative of s^j with respect to x is j!/(j-r)! s^(j-r)/h^r.
+ */
+void BSplineBasis1D::evaluateUniformDerivatives(double x, int u, unsigned int n, double *derivatives, unsigned int stride) const
+{
+    const double *M = UNIFORM_BASIS[degree];
+    double s = (x - knots[u])*uniformInverseSpacing;
+    double scale = UNIFORM_BASIS_SCALE[degree];
 
-    for (int i : supportedBasisFunctions)
+    for (unsigned int r = 0; r <= n; r++)
     {
-        // Differentiate basis function
-        // Equation 3.35 in Lyche & Moerken (2011)
-        double b1 = deBoorCox(x, i, degree-1);
-        double b2 = deBoorCox(x, i+1, degree-1);
+        double *row = derivatives + r*stride;
+
+        if (r > degree)
+        {
+            for (unsigned int k = 0; k <= degree; k++)
+                row[k] = 0;
+            continue;
+        }
+
+        for (unsigned int k = 0; k <= degree; k++)
+        {
+            const double *coefficients = M + k*(degree+1);
+
+            // Horner's scheme for sum_(j>=r) M[k][j]*j!/(j-r)!*s^(j-r)
+            double value = 0;
+            for (int j = degree; j >= (int)r; j--)
+            {
+                double factor = 1;
+                for (int i = j-r+1; i <= j; i++)
+                    factor *= i;
+                value = value*s + factor*coefficients[j];
+            }
+            row[k] = scale*value;
+        }
 
-        double t11 = knots.at(i);
-        double t12 = knots.at(i+degree);
-        double t21 = knots.at(i+1);
-        double t22 = knots.at(i+degree+1);
+        scale *= uniformInverseSpacing;
+    }
+}
 
-        (t12 == t11) ? b1 = 0 : b1 = b1/(t12-t11);
-        (t22 == t21) ? b2 = 0 : b2 = b2/(t22-t21);
+SparseVector BSplineBasis1D::evaluateDerivative(double x, int r) const
+{
+    // Evaluate rth derivative of basis functions at x
+    // Returns vector [D^(r)B_(u-p,p)(x) ... D^(r)B_(u,p)(x)]
+    // where u is the knot index and p is the degree
+    unsigned int m = degree + 1;
+    std::vector<double> derivatives((r+1)*m);
 
-        values.insert(i) = degree*(b1 - b2);
+    int knotIndex = evaluateNonZeroDerivatives(x, r, derivatives.data(), m);
+
+    // From dense row to extended sparse vector
+    SparseVector DB(getNumBasisFunctions());
+    DB.reserve(m);
+    for (unsigned int k = 0; k < m; k++)
+    {
+        DB.insert(knotIndex-degree+k) = derivatives.at(r*m+k);
     }
 
-    return values;
+    return DB;
 }
 
-// Used to evaluate basis functions - alternative to the recursive deBoorCox
+SparseVector BSplineBasis1D::evaluateFirstDerivative(double x) const
+{
+    return evaluateDerivative(x, 1);
+}
+
+// Builds the basis matrices used to compute knot insertion matrices
 SparseMatrix BSplineBasis1D::buildBasisMatrix(double x, unsigned int u, unsigned int k, bool diff) const
 {
     /* Build B-spline Matrix
@@ -230,42 +433,6 @@ SparseMatrix BSplineBasis1D::buildBasisMatrix(double x, unsigned int u, unsigned
     return R;
 }
 
-double BSplineBasis1D::deBoorCox(double x, int i, int k) const
-{
-    if (k == 0)
-    {
-        if (inHalfopenInterval(x, knots.at(i), knots.at(i+1)))
-        {
-            return 1;
-        }
-        else
-        {
-            return 0;
-        }
-    }
-    else
-    {
-        double s1,s2,r1,r2;
-
-        s1 = deBoorCoxCoeff(x, knots.at(i),   knots.at(i+k));
-        s2 = deBoorCoxCoeff(x, knots.at(i+1), knots.at(i+k+1));
-
-        r1 = deBoorCox(x, i,   k-1);
-        r2 = deBoorCox(x, i+1, k-1);
-
-        return s1*r1 + (1-s2)*r2;
-    }
-}
-
-double BSplineBasis1D::deBoorCoxCoeff(double x, double x_min, double x_max) const
-{
-    if (x_min < x_max && x_min <= x && x <= x_max)
-    {
-        return (x - x_min)/(x_max - x_min);
-    }
-    return 0;
-}
-
 // Insert knots and compute knot insertion matrix (to update control points)
 SparseMatrix BSplineBasis1D::insertKnots(double tau, unsigned int multiplicity)
 {
@@ -290,6 +457,7 @@ SparseMatrix BSplineBasis1D::insertKnots(double tau, unsigned int multiplicity)
 
     // Update knots
     knots = extKnots;
+    updateUniformKnots();
 
     return A;
 }
@@ -315,6 +483,7 @@ SparseMatrix BSplineBasis1D::refineKnots()
 
     // Update knots
     knots = refinedKnots;
+    updateUniformKnots();
 
     return A;
 }
@@ -374,6 +543,7 @@ SparseMatrix BSplineBasis1D::refineKnotsLocally(double x)
 
     // Update knots
     knots = refinedKnots;
+    updateUniformKnots();
 
     return A;
 }
@@ -407,6 +577,7 @@ SparseMatrix BSplineBasis1D::decomposeToBezierForm()
 
     // Update knots
     knots = refinedKnots;
+    updateUniformKnots();
 
     return A;
 }
@@ -480,6 +651,20 @@ int BSplineBasis1D::indexHalfopenInterval(double x) const
     if (x < knots.front() || x > knots.back())
         throw Exception("BSplineBasis1D::indexHalfopenInterval: x outside knot interval!");
 
+    // On the uniform knots, the interval is found in constant time (corrected for rounding)
+    if (knots[uniformBegin] <= x && x < knots[uniformEnd])
+    {
+        int index = uniformBegin + (int)((x - knots[uniformBegin])*uniformInverseSpacing);
+        index = std::min(index, uniformEnd - 1);
+
+        if (x < knots[index])
+            index--;
+        else if (x >= knots[index+1])
+            index++;
+
+        return index;
+    }
+
     // Find first knot that is larger than x
     std::vector<double>::const_iterator it = std::upper_bound(knots.begin(), knots.end(), x);
 
@@ -488,7 +673,7 @@ int BSplineBasis1D::indexHalfopenInterval(double x) const
     return index - 1;
 }
 
-bool BSplineBasis1D::reduceSupport(double lb, double ub, SparseMatrix &A)
+bool BSplineBasis1D::reduceSupport(double lb, double ub, unsigned int &first)
 {
     // Check bounds
     if (lb < knots.front() || ub > knots.back())
@@ -533,18 +718,17 @@ bool BSplineBasis1D::reduceSupport(double lb, double ub, SparseMatrix &A)
     std::vector<double> si;
     si.insert(si.begin(), knots.begin()+index_lower, knots.begin()+index_upper+k+1);
 
-    // Construct selection matrix A
+    // The remaining basis functions are index_lower,...,index_lower+numNew-1
     int numOld = knots.size()-k; // Current number of basis functions
     int numNew = si.size()-k; // Number of basis functions after update
 
     if (numOld < numNew) return false;
 
-    DenseMatrix Ad = DenseMatrix::Zero(numOld, numNew);
-    Ad.block(index_lower, 0, numNew, numNew) = DenseMatrix::Identity(numNew, numNew);
-    A = Ad.sparseView();
+    first = index_lower;
 
     // Update knots
     knots = si;
+    updateUniformKnots();
 
     return true;
 }
@@ -559,11 +743,6 @@ unsigned int BSplineBasis1D::knotMultiplicity(double tau) const
     return std::count(knots.begin(), knots.end(), tau);
 }
 
-bool BSplineBasis1D::inHalfopenInterval(double x, double x_min, double x_max) const
-{
-    return (x_min <= x) && (x < x_max);
-}
-
 bool BSplineBasis1D::insideSupport(double x) const
 {
     return (knots.front() <= x) && (x <= knots.back());
@@ -579,6 +758,19 @@ unsigned int BSplineBasis1D::getNumBasisFunctionsTarget() const
     return targetNumBasisfunctions;
 }
 
+/*
+ * The basis functions that are nonzero on (lb, ub) are first,...,last, where first is
+ * the smallest j with t_(j+p+1) > lb and last is the largest j with t_j < ub.
+ */
+void BSplineBasis1D::indexSupportedBasisfunctions(double lb, double ub, unsigned int &first, unsigned int &last) const
+{
+    int lower = std::upper_bound(knots.begin(), knots.end(), lb) - knots.begin() - (degree + 1);
+    int upper = std::lower_bound(knots.begin(), knots.end(), ub) - knots.begin() - 1;
+
+    first = std::max(lower, 0);
+    last = std::min(upper, (int)getNumBasisFunctions() - 1);
+}
+
 // Return indices of supporting basis functions at x
 std::vector<int> BSplineBasis1D::indexSupportedBasisfunctions(double x) const
 {
@@ -623,6 +815,59 @@ unsigned int BSplineBasis1D::indexLongestInterval(const std::vector<double> &vec
     return index;
 }
 
+/*
+ * Finds the longest run of uniformly spaced knots (relative tolerance 1e-10 on the spacing),
+ * which enables constant time interval lookup in indexHalfopenInterval. A span u is uniform
+ * if the knots u-p+1,...,u+p that define the basis functions on it all belong to the run,
+ * and the degree has a precomputed uniform basis matrix.
+ */
+void BSplineBasis1D::updateUniformKnots()
+{
+    uniformBegin = uniformEnd = 0;
+    uniformSpacing = uniformInverseSpacing = 0;
+
+    int numKnots = knots.size();
+    int begin = 0;
+
+    while (begin + 1 < numKnots)
+    {
+        double h = knots[begin+1] - knots[begin];
+        if (h <= 0)
+        {
+            begin++;
+            continue;
+        }
+
+        int end = begin + 1;
+        while (end + 1 < numKnots && std::abs(knots[end+1] - knots[end] - h) <= 1e-10*h)
+            end++;
+
+        // A single interval does not count as uniform
+        if (end - begin > std::max(uniformEnd - uniformBegin, 1))
+        {
+            uniformBegin = begin;
+            uniformEnd = end;
+        }
+
+        begin = end;
+    }
+
+    uniformSpanBegin = uniformSpanEnd = 0;
+
+    if (!hasUniformKnots())
+        return;
+
+    // The average spacing is used, since the knots are only uniform up to rounding
+    uniformSpacing = (knots[uniformEnd] - knots[uniformBegin])/(uniformEnd - uniformBegin);
+    uniformInverseSpacing = 1.0/uniformSpacing;
+
+    if (degree <= MAX_UNIFORM_DEGREE && uniformEnd - uniformBegin >= 2*(int)degree - 1)
+    {
+        uniformSpanBegin = uniformBegin + degree - 1;
+        uniformSpanEnd = uniformEnd - degree + 1;
+    }
+}
+
 bool BSplineBasis1D::isKnotVectorRegular() const
 {
     return isKnotVectorRegular(knots);
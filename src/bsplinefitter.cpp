@@ -0,0 +1,166 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "bsplinefitter.h"
+#include "mykroneckerproduct.h"
+
+namespace SPLINTER
+{
+
+BSplineFitter::BSplineFitter(const DataTable &samples, unsigned int degree)
+    : numSamples(samples.getNumSamples())
+{
+    init(samples, degree);
+}
+
+BSplineFitter::BSplineFitter(const DataTable &samples, BSplineType type)
+    : numSamples(samples.getNumSamples())
+{
+    unsigned int degree = 3;
+    if (type == BSplineType::LINEAR)
+        degree = 1;
+    else if (type == BSplineType::QUADRATIC)
+        degree = 2;
+    else if (type == BSplineType::QUARTIC)
+        degree = 4;
+
+    init(samples, degree);
+}
+
+/*
+ * Sets up the interpolating B-spline basis of the grid (as in the BSpline constructors), factorizes
+ * the collocation matrices and fits the samples with these factorizations, so that the collocation
+ * matrices are factorized only once
+ */
+void BSplineFitter::init(const DataTable &samples, unsigned int degree)
+{
+    if (!samples.isGridComplete())
+        throw Exception("BSplineFitter::init: Cannot fit a B-spline to an irregular (incomplete) grid.");
+
+    bspline.numVariables = samples.getNumVariables();
+
+    std::vector< std::vector<double> > xdata = samples.getTableX();
+    std::vector<unsigned int> basisDegrees(samples.getNumVariables(), degree);
+    bspline.basis = BSplineBasis(xdata, basisDegrees, KnotVectorType::FREE);
+    bspline.computeKnotAverages();
+
+    std::vector<SparseMatrix> collocationMatrices;
+    bspline.computeCollocationMatrices(samples, collocationMatrices);
+
+    for (auto &A : collocationMatrices)
+    {
+        if (A.rows() != A.cols())
+            throw Exception("BSplineFitter::init: The collocation matrices must be square.");
+
+        SparseLUFactorization lu;
+        if (!lu.compute(A))
+            throw Exception("BSplineFitter::init: Failed to factorize the collocation matrices.");
+
+        dims.push_back(A.rows());
+        factorizations.push_back(lu);
+    }
+
+    bspline = refit(samples.getVectorY());
+    bspline.init();
+    bspline.checkControlPoints();
+}
+
+BSpline BSplineFitter::refit(const std::vector<double> &y) const
+{
+    if (y.size() != numSamples)
+        throw Exception("BSplineFitter::refit: Wrong number of sample values.");
+
+    DenseVector tensor = Eigen::Map<const DenseVector>(y.data(), y.size());
+    std::vector<unsigned int> tensorDims = dims;
+
+    for (unsigned int i = 0; i < dims.size(); i++)
+    {
+        DenseMatrix B, C;
+        unfoldTensor(tensor, tensorDims, i, B);
+
+        if (!factorizations.at(i).solve(B, C))
+            throw Exception("BSplineFitter::refit: Failed to solve for B-spline coefficients.");
+
+        foldTensor(C, tensorDims, i, tensor);
+    }
+
+    BSpline result(bspline);
+    result.coefficients = tensor.transpose();
+
+    return result;
+}
+
+PSplineFitter::PSplineFitter(const DataTable &samples, double lambda)
+    : numSamples(samples.getNumSamples())
+{
+    init(samples);
+    pspline.lambda = lambda;
+    fit(samples);
+}
+
+PSplineFitter::PSplineFitter(const DataTable &samples, SmoothingParameterSelection selection)
+    : numSamples(samples.getNumSamples())
+{
+    init(samples);
+    pspline.lambda = pspline.selectLambda(samples, system, selection);
+    fit(samples);
+}
+
+/*
+ * Sets up the cubic P-spline basis of the grid (as in the PSpline constructors) and the univariate matrices
+ * of the P-spline equations, which are then used both to fit the samples and for the refits
+ */
+void PSplineFitter::init(const DataTable &samples)
+{
+    if (!samples.isGridComplete())
+        throw Exception("PSplineFitter::init: Cannot fit a P-spline to an irregular (incomplete) grid.");
+
+    pspline.numVariables = samples.getNumVariables();
+
+    std::vector< std::vector<double> > xdata = samples.getTableX();
+    std::vector<unsigned int> basisDegrees(samples.getNumVariables(), 3);
+    pspline.basis = BSplineBasis(xdata, basisDegrees, KnotVectorType::FREE);
+
+    if (!pspline.computeKroneckerSystem(samples, system))
+        throw Exception("PSplineFitter::init: Failed to set up the P-spline equations.");
+}
+
+void PSplineFitter::fit(const DataTable &samples)
+{
+    if (!pspline.solveKroneckerSystem(samples, system))
+        throw Exception("PSplineFitter::fit: Failed to solve for B-spline coefficients.");
+
+    pspline.init();
+    pspline.checkControlPoints();
+}
+
+PSpline PSplineFitter::refit(const std::vector<double> &y) const
+{
+    return refit(y, pspline);
+}
+
+PSpline PSplineFitter::refit(const std::vector<double> &y, const BSpline &current) const
+{
+    if (y.size() != numSamples)
+        throw Exception("PSplineFitter::refit: Wrong number of sample values.");
+
+    if (current.getNumControlPoints() != pspline.getNumControlPoints())
+        throw Exception("PSplineFitter::refit: The current B-spline has the wrong number of coefficients.");
+
+    DenseVector c = current.getControlPoints().row(current.getNumVariables()).transpose();
+    if (!pspline.solveKroneckerSystem(system, Eigen::Map<const DenseVector>(y.data(), y.size()), c))
+        throw Exception("PSplineFitter::refit: Failed to solve for B-spline coefficients.");
+
+    PSpline result(pspline);
+    result.coefficients = c.transpose();
+
+    return result;
+}
+
+} // namespace SPLINTER
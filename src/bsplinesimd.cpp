@@ -0,0 +1,58 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+// Generic kernel, compiled for the baseline instruction set
+#define SPLINTER_SIMD_NAMESPACE generic
+#include "bsplinesimdkernel.h"
+#undef SPLINTER_SIMD_NAMESPACE
+
+namespace SPLINTER
+{
+
+typedef void (*SimdKernel)(const SimdBlock &block, double *y);
+
+struct SimdDispatch
+{
+    SimdKernel kernel;
+    const char *instructionSet;
+};
+
+/*
+ * Selects the AVX2 kernel if it is compiled in (SPLINTER_SIMD_AVX2 is defined by the
+ * build system) and supported by the CPU, and the generic kernel otherwise.
+ */
+static SimdDispatch selectSimdKernel()
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+# ifdef SPLINTER_SIMD_AVX2
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return {avx2::evalSimdBlock, "avx2"};
+# endif
+#endif
+    return {generic::evalSimdBlock, "generic"};
+}
+
+static const SimdDispatch &getSimdDispatch()
+{
+    static const SimdDispatch dispatch = selectSimdKernel();
+    return dispatch;
+}
+
+void evalSimdBlock(const SimdBlock &block, double *y)
+{
+    getSimdDispatch().kernel(block, y);
+}
+
+const char *getSimdInstructionSet()
+{
+    return getSimdDispatch().instructionSet;
+}
+
+} // namespace SPLINTER
@@ -0,0 +1,12 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+// Kernel compiled with AVX2 enabled (see CMakeLists.txt), only called on CPUs that support it
+#define SPLINTER_SIMD_NAMESPACE avx2
+#include "bsplinesimdkernel.h"
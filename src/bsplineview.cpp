@@ -0,0 +1,120 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "bsplineview.h"
+
+namespace SPLINTER
+{
+
+BSplineView::BSplineView(const BSpline &bspline)
+    : BSplineView(std::make_shared<const BSpline>(bspline))
+{
+}
+
+BSplineView::BSplineView(std::shared_ptr<const BSpline> bspline)
+    : bspline(bspline),
+      numVariables(bspline->getNumVariables()),
+      lb(bspline->getDomainLowerBound()),
+      ub(bspline->getDomainUpperBound())
+{
+    computeBasisFunctionRanges();
+}
+
+BSplineView BSplineView::reduceDomain(const std::vector<double> &lb, const std::vector<double> &ub) const
+{
+    if (lb.size() != numVariables || ub.size() != numVariables)
+        throw Exception("BSplineView::reduceDomain: Inconsistent vector sizes!");
+
+    for (unsigned int dim = 0; dim < numVariables; dim++)
+    {
+        if (ub.at(dim) <= lb.at(dim))
+            throw Exception("BSplineView::reduceDomain: Cannot reduce B-spline domain to empty set!");
+
+        if (lb.at(dim) < this->lb.at(dim) || ub.at(dim) > this->ub.at(dim))
+            throw Exception("BSplineView::reduceDomain: Cannot expand B-spline domain!");
+    }
+
+    // The new view refers directly to the original B-spline
+    BSplineView view(*this);
+    view.lb = lb;
+    view.ub = ub;
+    view.computeBasisFunctionRanges();
+
+    return view;
+}
+
+void BSplineView::computeBasisFunctionRanges()
+{
+    std::vector<unsigned int> last;
+    bspline->basis.indexSupportedBasisfunctions(lb, ub, firstBasisFunction, last);
+
+    numBasisFunctions.clear();
+    for (unsigned int i = 0; i < numVariables; i++)
+        numBasisFunctions.push_back(last.at(i) - firstBasisFunction.at(i) + 1);
+}
+
+BSpline BSplineView::materialize(bool doRegularizeKnotVectors) const
+{
+    return bspline->sliceDomain(lb, ub, doRegularizeKnotVectors);
+}
+
+void BSplineView::bounds(double &lower, double &upper, bool tight) const
+{
+    bspline->bounds(lb, ub, lower, upper, tight);
+}
+
+double BSplineView::eval(const DenseVector &x) const
+{
+    if (!pointInDomain(x))
+        throw Exception("BSplineView::eval: Evaluation at point outside domain.");
+
+    return bspline->eval(x);
+}
+
+DenseMatrix BSplineView::evalJacobian(const DenseVector &x) const
+{
+    if (!pointInDomain(x))
+        throw Exception("BSplineView::evalJacobian: Evaluation at point outside domain.");
+
+    return bspline->evalJacobian(x);
+}
+
+DenseMatrix BSplineView::evalHessian(const DenseVector &x) const
+{
+    if (!pointInDomain(x))
+        throw Exception("BSplineView::evalHessian: Evaluation at point outside domain.");
+
+    return bspline->evalHessian(x);
+}
+
+void BSplineView::save(const std::string fileName) const
+{
+    materialize().save(fileName);
+}
+
+void BSplineView::load(const std::string fileName)
+{
+    *this = BSplineView(BSpline(fileName));
+}
+
+bool BSplineView::pointInDomain(const DenseVector &x) const
+{
+    if (x.size() != numVariables)
+        return false;
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        if (x(i) < lb.at(i) || x(i) > ub.at(i))
+            return false;
+    }
+
+    return true;
+}
+
+} // namespace SPLINTER
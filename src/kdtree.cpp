@@ -0,0 +1,183 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "kdtree.h"
+#include <algorithm>
+
+namespace SPLINTER
+{
+
+KdTree::KdTree(const DenseMatrix &points, unsigned int leafSize)
+    : numVariables(points.cols()),
+      leafSize(std::max(leafSize, 1u))
+{
+    if (points.rows() < 1 || numVariables < 1)
+        throw Exception("KdTree::KdTree: Cannot build tree without points!");
+
+    indices.resize(points.rows());
+    for (unsigned int i = 0; i < indices.size(); i++)
+        indices.at(i) = i;
+
+    build(points, 0, indices.size());
+
+    // Store the points in the order of the tree
+    this->points.resize(points.rows(), numVariables);
+    for (unsigned int i = 0; i < indices.size(); i++)
+        this->points.row(i) = points.row(indices.at(i));
+}
+
+unsigned int KdTree::build(const DenseMatrix &input, unsigned int begin, unsigned int end)
+{
+    unsigned int index = nodes.size();
+    nodes.push_back(Node());
+    nodes.at(index).begin = begin;
+    nodes.at(index).end = end;
+    nodes.at(index).splitVariable = -1;
+
+    if (end - begin <= leafSize)
+        return index;
+
+    // Split the variable with the largest spread
+    int splitVariable = 0;
+    double maxSpread = -1;
+    for (unsigned int j = 0; j < numVariables; j++)
+    {
+        double lb = input(indices.at(begin), j), ub = lb;
+        for (unsigned int i = begin + 1; i < end; i++)
+        {
+            lb = std::min(lb, input(indices.at(i), j));
+            ub = std::max(ub, input(indices.at(i), j));
+        }
+
+        if (ub - lb > maxSpread)
+        {
+            maxSpread = ub - lb;
+            splitVariable = j;
+        }
+    }
+
+    // All points are equal
+    if (maxSpread <= 0)
+        return index;
+
+    unsigned int middle = begin + (end - begin)/2;
+    std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end,
+                     [&input, splitVariable](unsigned int a, unsigned int b)
+                     {
+                         return input(a, splitVariable) < input(b, splitVariable);
+                     });
+
+    // The children are built before the split is stored, since they may reallocate nodes
+    double splitValue = input(indices.at(middle), splitVariable);
+    unsigned int left = build(input, begin, middle);
+    unsigned int right = build(input, middle, end);
+
+    nodes.at(index).splitVariable = splitVariable;
+    nodes.at(index).splitValue = splitValue;
+    nodes.at(index).left = left;
+    nodes.at(index).right = right;
+
+    return index;
+}
+
+std::vector<unsigned int> KdTree::nearest(const DenseVector &x, unsigned int k) const
+{
+    if (x.size() != numVariables)
+        throw Exception("KdTree::nearest: Wrong number of variables.");
+
+    k = std::min(k, getNumPoints());
+
+    // Max-heap of the k closest points found so far
+    std::vector<Neighbour> heap;
+    heap.reserve(k + 1);
+    if (k > 0)
+        nearest(0, x, k, heap);
+
+    std::sort_heap(heap.begin(), heap.end());
+
+    std::vector<unsigned int> result;
+    for (auto &neighbour : heap)
+        result.push_back(neighbour.second);
+
+    return result;
+}
+
+void KdTree::nearest(unsigned int node, const DenseVector &x, unsigned int k, std::vector<Neighbour> &heap) const
+{
+    const Node &n = nodes.at(node);
+
+    if (n.splitVariable < 0)
+    {
+        for (unsigned int i = n.begin; i < n.end; i++)
+        {
+            Neighbour neighbour((points.row(i).transpose() - x).squaredNorm(), indices.at(i));
+
+            if (heap.size() < k)
+            {
+                heap.push_back(neighbour);
+                std::push_heap(heap.begin(), heap.end());
+            }
+            else if (neighbour < heap.front())
+            {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = neighbour;
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+        return;
+    }
+
+    // Visit the side of x first, and the other side only if it may hold closer points
+    double diff = x(n.splitVariable) - n.splitValue;
+    unsigned int nearChild = diff < 0 ? n.left : n.right;
+    unsigned int farChild = diff < 0 ? n.right : n.left;
+
+    nearest(nearChild, x, k, heap);
+
+    if (heap.size() < k || diff*diff <= heap.front().first)
+        nearest(farChild, x, k, heap);
+}
+
+std::vector<unsigned int> KdTree::withinRadius(const DenseVector &x, double radius) const
+{
+    if (x.size() != numVariables)
+        throw Exception("KdTree::withinRadius: Wrong number of variables.");
+
+    std::vector<unsigned int> result;
+    if (radius >= 0)
+        withinRadius(0, x, radius*radius, result);
+
+    std::sort(result.begin(), result.end());
+
+    return result;
+}
+
+void KdTree::withinRadius(unsigned int node, const DenseVector &x, double radius2, std::vector<unsigned int> &result) const
+{
+    const Node &n = nodes.at(node);
+
+    if (n.splitVariable < 0)
+    {
+        for (unsigned int i = n.begin; i < n.end; i++)
+        {
+            if ((points.row(i).transpose() - x).squaredNorm() <= radius2)
+                result.push_back(indices.at(i));
+        }
+        return;
+    }
+
+    double diff = x(n.splitVariable) - n.splitValue;
+
+    if (diff < 0 || diff*diff <= radius2)
+        withinRadius(n.left, x, radius2, result);
+    if (diff >= 0 || diff*diff <= radius2)
+        withinRadius(n.right, x, radius2, result);
+}
+
+} // namespace SPLINTER
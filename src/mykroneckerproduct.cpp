@@ -92,4 +92,53 @@ void myKroneckerProduct(const SparseMatrix &A, const SparseMatrix &B, SparseMatr
     AB.makeCompressed();
 }
 
+void unfoldTensor(const DenseVector &tensor, const std::vector<unsigned int> &dims, unsigned int mode, DenseMatrix &matrix)
+{
+    unsigned int n = dims.at(mode);
+    unsigned int inner = 1;
+    for (unsigned int i = mode + 1; i < dims.size(); i++)
+        inner *= dims.at(i);
+    unsigned int outer = tensor.size()/(n*inner);
+
+    matrix.resize(n, outer*inner);
+
+    for (unsigned int o = 0; o < outer; o++)
+        for (unsigned int k = 0; k < n; k++)
+            for (unsigned int q = 0; q < inner; q++)
+                matrix(k, o*inner + q) = tensor((o*n + k)*inner + q);
+}
+
+void foldTensor(const DenseMatrix &matrix, std::vector<unsigned int> &dims, unsigned int mode, DenseVector &tensor)
+{
+    unsigned int n = matrix.rows();
+    unsigned int inner = 1;
+    for (unsigned int i = mode + 1; i < dims.size(); i++)
+        inner *= dims.at(i);
+    unsigned int outer = matrix.cols()/inner;
+
+    dims.at(mode) = n;
+    tensor.resize(outer*n*inner);
+
+    for (unsigned int o = 0; o < outer; o++)
+        for (unsigned int k = 0; k < n; k++)
+            for (unsigned int q = 0; q < inner; q++)
+                tensor((o*n + k)*inner + q) = matrix(k, o*inner + q);
+}
+
+void tensorModeProduct(const DenseMatrix &A, std::vector<unsigned int> &dims, unsigned int mode, DenseVector &tensor)
+{
+    DenseMatrix M;
+    unfoldTensor(tensor, dims, mode, M);
+    DenseMatrix AM = A*M;
+    foldTensor(AM, dims, mode, tensor);
+}
+
+void tensorModeProduct(const SparseMatrix &A, std::vector<unsigned int> &dims, unsigned int mode, DenseVector &tensor)
+{
+    DenseMatrix M;
+    unfoldTensor(tensor, dims, mode, M);
+    DenseMatrix AM = A*M;
+    foldTensor(AM, dims, mode, tensor);
+}
+
 } // namespace SPLINTER
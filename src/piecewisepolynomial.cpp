@@ -0,0 +1,294 @@
+/*
+ * This file is part of the SPLINTER library.
+ * Copyright (C) 2012 Bjarne Grimstad (bjarne.grimstad@gmail.com).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "piecewisepolynomial.h"
+#include "serialize.h"
+#include <algorithm>
+#include <cmath>
+
+namespace SPLINTER
+{
+
+/*
+ * Returns the (p+1) x (p+1) matrix Q that maps the Bernstein coefficients b of a polynomial
+ * of degree p on an interval of width h to its power basis coefficients: f(a + dx) = sum_j (Q*b)_j dx^j.
+ * With s = dx/h, B_k(s) = binom(p,k) s^k (1-s)^(p-k) = sum_(j>=k) binom(p,k) binom(p-k,j-k) (-1)^(j-k) s^j.
+ */
+static DenseMatrix bernsteinToPowerMatrix(unsigned int p, double h)
+{
+    // Binomial coefficients
+    DenseMatrix binom = DenseMatrix::Zero(p+1, p+1);
+    for (unsigned int n = 0; n <= p; n++)
+    {
+        binom(n,0) = 1;
+        for (unsigned int k = 1; k <= n; k++)
+            binom(n,k) = binom(n-1,k-1) + (k < n ? binom(n-1,k) : 0);
+    }
+
+    DenseMatrix Q = DenseMatrix::Zero(p+1, p+1);
+    for (unsigned int j = 0; j <= p; j++)
+    {
+        double scale = std::pow(h, -(double)j);
+        for (unsigned int k = 0; k <= j; k++)
+        {
+            double sign = (j - k) % 2 == 0 ? 1 : -1;
+            Q(j,k) = sign*binom(p,k)*binom(p-k,j-k)*scale;
+        }
+    }
+
+    return Q;
+}
+
+PiecewisePolynomial::PiecewisePolynomial(const BSpline &bspline)
+    : numVariables(bspline.getNumVariables()),
+      degrees(bspline.getBasisDegrees())
+{
+    if (numVariables > MAX_LOCAL_NUM_VARIABLES)
+        throw Exception("PiecewisePolynomial::PiecewisePolynomial: Too many variables.");
+
+    // In Bezier form, every knot has multiplicity p+1 and cell j in variable i
+    // is the support of basis functions j*(p_i+1),...,j*(p_i+1)+p_i
+    BSpline bezier(bspline);
+    bezier.decomposeToBezierForm();
+
+    DenseMatrix controlPoints = bezier.getControlPoints();
+    DenseVector bezierCoefficients = controlPoints.row(numVariables).transpose();
+
+    std::vector< std::vector<double> > knotVectors = bezier.getKnotVectors();
+    std::vector<unsigned int> numBasisFunctions = bezier.getNumBasisFunctions();
+
+    std::vector<unsigned int> numCells;
+    for (auto &knots : knotVectors)
+    {
+        std::vector<double> distinct(knots);
+        distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+        breakpoints.push_back(distinct);
+        numCells.push_back(distinct.size() - 1);
+    }
+
+    // Strides within a cell and in the Bezier coefficient vector (last variable fastest)
+    strides.resize(numVariables);
+    std::vector<unsigned int> bezierStrides(numVariables);
+    cellSize = 1;
+    unsigned int bezierStride = 1;
+    unsigned int totalNumCells = 1;
+    for (int i = numVariables - 1; i >= 0; i--)
+    {
+        strides.at(i) = cellSize;
+        bezierStrides.at(i) = bezierStride;
+        cellSize *= degrees.at(i) + 1;
+        bezierStride *= numBasisFunctions.at(i);
+        totalNumCells *= numCells.at(i);
+    }
+
+    coefficients.resize(totalNumCells*cellSize);
+
+    std::vector<double> block(cellSize), temp(cellSize);
+    std::vector<unsigned int> cell(numVariables, 0), k(numVariables);
+
+    for (unsigned int j = 0; j < totalNumCells; j++)
+    {
+        // Gather the Bernstein coefficients of the cell
+        unsigned int first = 0;
+        for (unsigned int i = 0; i < numVariables; i++)
+            first += cell.at(i)*(degrees.at(i) + 1)*bezierStrides.at(i);
+
+        for (unsigned int l = 0; l < cellSize; l++)
+        {
+            unsigned int index = first;
+            for (unsigned int i = 0; i < numVariables; i++)
+                index += ((l/strides.at(i)) % (degrees.at(i) + 1))*bezierStrides.at(i);
+            block.at(l) = bezierCoefficients(index);
+        }
+
+        // Convert to the power basis one variable (mode) at a time
+        for (unsigned int i = 0; i < numVariables; i++)
+        {
+            unsigned int m = degrees.at(i) + 1;
+            unsigned int inner = strides.at(i);
+            unsigned int outer = cellSize/(m*inner);
+            double h = breakpoints.at(i).at(cell.at(i)+1) - breakpoints.at(i).at(cell.at(i));
+            DenseMatrix Q = bernsteinToPowerMatrix(degrees.at(i), h);
+
+            for (unsigned int o = 0; o < outer; o++)
+            {
+                for (unsigned int n = 0; n < inner; n++)
+                {
+                    for (unsigned int r = 0; r < m; r++)
+                    {
+                        double sum = 0;
+                        for (unsigned int c = 0; c < m; c++)
+                            sum += Q(r,c)*block.at((o*m + c)*inner + n);
+                        temp.at((o*m + r)*inner + n) = sum;
+                    }
+                }
+            }
+
+            block.swap(temp);
+        }
+
+        std::copy(block.begin(), block.end(), coefficients.begin() + j*cellSize);
+
+        // Next cell (last variable fastest)
+        for (int i = numVariables - 1; i >= 0; i--)
+        {
+            if (++cell.at(i) < numCells.at(i))
+                break;
+            cell.at(i) = 0;
+        }
+    }
+}
+
+/*
+ * Construct from saved data
+ */
+PiecewisePolynomial::PiecewisePolynomial(const std::string fileName)
+{
+    load(fileName);
+}
+
+unsigned int PiecewisePolynomial::getNumCells() const
+{
+    return coefficients.size()/cellSize;
+}
+
+double PiecewisePolynomial::eval(const DenseVector &x) const
+{
+    double dx[MAX_LOCAL_NUM_VARIABLES];
+    const double *c = findCell(x, dx);
+
+    unsigned int orders[MAX_LOCAL_NUM_VARIABLES] = {0};
+    return horner(c, dx, orders);
+}
+
+DenseMatrix PiecewisePolynomial::evalJacobian(const DenseVector &x) const
+{
+    double dx[MAX_LOCAL_NUM_VARIABLES];
+    const double *c = findCell(x, dx);
+
+    DenseMatrix J(1, numVariables);
+    unsigned int orders[MAX_LOCAL_NUM_VARIABLES] = {0};
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        orders[i] = 1;
+        J(0,i) = horner(c, dx, orders);
+        orders[i] = 0;
+    }
+
+    return J;
+}
+
+DenseMatrix PiecewisePolynomial::evalHessian(const DenseVector &x) const
+{
+    double dx[MAX_LOCAL_NUM_VARIABLES];
+    const double *c = findCell(x, dx);
+
+    DenseMatrix H(numVariables, numVariables);
+    unsigned int orders[MAX_LOCAL_NUM_VARIABLES] = {0};
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        for (unsigned int j = 0; j <= i; j++)
+        {
+            orders[i]++;
+            orders[j]++;
+            H(i,j) = horner(c, dx, orders);
+            H(j,i) = H(i,j);
+            orders[i]--;
+            orders[j]--;
+        }
+    }
+
+    return H;
+}
+
+void PiecewisePolynomial::save(const std::string fileName) const
+{
+    // Serialize
+    StreamType stream;
+    serialize(numVariables, stream);
+    serialize(degrees, stream);
+    serialize(breakpoints, stream);
+    serialize(strides, stream);
+    serialize(cellSize, stream);
+    serialize(coefficients, stream);
+
+    // Save stream to file
+    save_to_file(fileName, stream);
+}
+
+void PiecewisePolynomial::load(const std::string fileName)
+{
+    // Load stream from file
+    StreamType stream = load_from_file(fileName);
+
+    // Deserialize
+    auto it = stream.cbegin();
+    numVariables = deserialize<unsigned int>(it, stream.cend());
+    degrees = deserialize<std::vector<unsigned int>>(it, stream.cend());
+    breakpoints = deserialize<std::vector<std::vector<double>>>(it, stream.cend());
+    strides = deserialize<std::vector<unsigned int>>(it, stream.cend());
+    cellSize = deserialize<unsigned int>(it, stream.cend());
+    coefficients = deserialize<std::vector<double>>(it, stream.cend());
+}
+
+const double *PiecewisePolynomial::findCell(const DenseVector &x, double *dx) const
+{
+    if (x.size() != numVariables)
+        throw Exception("PiecewisePolynomial::findCell: Wrong number of variables.");
+
+    unsigned int cell = 0;
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        const std::vector<double> &bp = breakpoints[i];
+        double xi = x(i);
+
+        if (xi < bp.front() || xi > bp.back())
+            throw Exception("PiecewisePolynomial::findCell: Evaluation at point outside domain.");
+
+        // Half-open cells, except the last one which includes its upper bound
+        unsigned int numCells = bp.size() - 1;
+        unsigned int j = std::upper_bound(bp.begin(), bp.end(), xi) - bp.begin() - 1;
+        j = std::min(j, numCells - 1);
+
+        cell = cell*numCells + j;
+        dx[i] = xi - bp[j];
+    }
+
+    return coefficients.data() + cell*cellSize;
+}
+
+/*
+ * Evaluates sum_k c_k prod_i dx_i^k_i, differentiated orders[i] times in variable i,
+ * one variable at a time: sum_k dx^(k-r) k!/(k-r)! (...) in Horner form.
+ */
+double PiecewisePolynomial::horner(const double *c, const double *dx, const unsigned int *orders, unsigned int dim) const
+{
+    int p = degrees[dim];
+    int r = orders[dim];
+    unsigned int stride = strides[dim];
+    bool last = dim + 1 == numVariables;
+
+    double sum = 0;
+    for (int k = p; k >= r; k--)
+    {
+        double term = last ? c[k] : horner(c + k*stride, dx, orders, dim+1);
+
+        for (int i = k-r+1; i <= k; i++)
+            term *= i;
+
+        sum = sum*dx[dim] + term;
+    }
+
+    return sum;
+}
+
+} // namespace SPLINTER
@@ -9,10 +9,19 @@
 
 #include "pspline.h"
 #include "linearsolvers.h"
+#include "mykroneckerproduct.h"
+#include "parallel.h"
+#include <cmath>
+#include <algorithm>
 
 namespace SPLINTER
 {
 
+PSpline::PSpline()
+    : lambda(0)
+{
+}
+
 PSpline::PSpline(const DataTable &samples)
     : PSpline(samples,0.03)
 {
@@ -38,8 +47,66 @@ PSpline::PSpline(const DataTable &samples, double lambda)
     checkControlPoints();
 }
 
+PSpline::PSpline(const DataTable &samples, SmoothingParameterSelection selection)
+    : lambda(0)
+{
+    if (!samples.isGridComplete())
+        throw Exception("PSpline::PSpline: Cannot select the smoothing parameter on an irregular (incomplete) grid.");
+
+    std::vector< std::vector<double> > xdata = samples.getTableX();
+
+    numVariables = samples.getNumVariables();
+
+    // Assuming a cubic spline
+    std::vector<unsigned int> basisDegrees(samples.getNumVariables(), 3);
+    basis = BSplineBasis(xdata, basisDegrees, KnotVectorType::FREE);
+
+    KroneckerSystem system;
+    if (!computeKroneckerSystem(samples, system))
+        throw Exception("PSpline::PSpline: Failed to set up the P-spline equations.");
+
+    lambda = selectLambda(samples, system, selection);
+
+    if (!solveKroneckerSystem(samples, system))
+        throw Exception("PSpline::PSpline: Failed to solve for B-spline coefficients.");
+
+    init();
+
+    checkControlPoints();
+}
+
+PSpline::PSpline(const DataTable &samples, std::vector< std::vector<double> > knotVectors, std::vector<unsigned int> basisDegrees,
+                 double lambda, const std::vector<double> &weights, unsigned int numThreads)
+    : lambda(lambda)
+{
+    numVariables = samples.getNumVariables();
+
+    if (knotVectors.size() != numVariables || basisDegrees.size() != numVariables)
+        throw Exception("PSpline::PSpline: Inconsistent number of knot vectors or basis degrees.");
+
+    if (!weights.empty() && weights.size() != samples.getNumSamples())
+        throw Exception("PSpline::PSpline: Inconsistent number of weights.");
+
+    for (auto w : weights)
+    {
+        if (!(w >= 0))
+            throw Exception("PSpline::PSpline: The weights must be nonnegative.");
+    }
+
+    basis = BSplineBasis(knotVectors, basisDegrees, KnotVectorType::EXPLICIT);
+    computeControlPointsScattered(samples, weights, numThreads);
+
+    init();
+
+    checkControlPoints();
+}
+
 void PSpline::computeControlPoints(const DataTable &samples)
 {
+    // On a complete grid, the equations are solved without forming B and L
+    if (computeControlPointsKronecker(samples))
+        return;
+
     // Assuming regular grid
     unsigned int numSamples = samples.getNumSamples();
 
@@ -56,7 +123,7 @@ void PSpline::computeControlPoints(const DataTable &samples)
      */
 
     SparseMatrix L, B, D, W;
-    DenseMatrix Rx, Ry, Bx, By;
+    DenseMatrix Bx, By;
 
     // Weight matrix
     W.resize(numSamples, numSamples);
@@ -71,13 +138,14 @@ void PSpline::computeControlPoints(const DataTable &samples)
     // Left-hand side matrix
     L = B.transpose()*W*B + lambda*D.transpose()*D;
 
-    // Compute right-hand side matrices
+    // Compute right-hand side matrices (both are solved with one factorization)
     controlPointEquationRHS(samples, Bx, By);
-    Rx = B.transpose()*W*Bx;
-    Ry = B.transpose()*W*By;
+    DenseMatrix BxBy(Bx.rows(), numVariables + 1);
+    BxBy << Bx, By;
+    DenseMatrix R = B.transpose()*W*BxBy;
 
-    // Matrices to store the resulting coefficients
-    DenseMatrix Cx, Cy;
+    // Matrix to store the resulting coefficients
+    DenseMatrix C;
 
     int numEquations = L.rows();
     int maxNumEquations = pow(2,10);
@@ -91,7 +159,7 @@ void PSpline::computeControlPoints(const DataTable &samples)
 #endif // NDEBUG
 
         SparseLU s;
-        bool successfulSolve = (s.solve(L,Rx,Cx) && s.solve(L,Ry,Cy));
+        bool successfulSolve = s.solve(L,R,C);
 
         solveAsDense = !successfulSolve;
     }
@@ -104,7 +172,7 @@ void PSpline::computeControlPoints(const DataTable &samples)
 
         DenseMatrix Ld = L.toDense();
         DenseQR s;
-        bool successfulSolve = s.solve(Ld, Rx, Cx) && s.solve(Ld, Ry, Cy);
+        bool successfulSolve = s.solve(Ld, R, C);
 
         if (!successfulSolve)
         {
@@ -112,8 +180,456 @@ void PSpline::computeControlPoints(const DataTable &samples)
         }
     }
 
-    coefficients = Cy.transpose();
-    knotaverages = Cx.transpose();
+    coefficients = C.rightCols(1).transpose();
+    knotaverages = C.leftCols(numVariables).transpose();
+}
+
+/*
+ * Solves the P-spline equations Lc = R on a complete grid in the manner of generalized linear
+ * array models, using only univariate matrices. With the samples and coefficients ordered with
+ * the last variable running fastest, B = B_1 x ... x B_d, and (since W = I)
+ *   L = G_1 x ... x G_d + l*(P_1 + ... + P_d), with G_i = B_i'*B_i,
+ * where P_i = I x ... x D_i'*D_i x ... x I is the second-order difference penalty in variable i
+ * (the blocks of D in getSecondOrderFiniteDifferenceMatrix). Products with B', L and the
+ * preconditioner are applied as mode products, and Lc = R is solved by preconditioned conjugate
+ * gradients. The preconditioner is L with the identities in the penalty replaced by G_i, which is
+ * diagonalized by the generalized eigenvectors D_i'*D_i*U_i = G_i*U_i*M_i (with U_i'*G_i*U_i = I):
+ *   M^-1 = U*(I + l*(M_1 + ... + M_d))^-1*U', with U = U_1 x ... x U_d.
+ * Each iteration costs O(N*sum_i n_i) operations. Returns false if the iterations do not converge.
+ */
+bool PSpline::computeControlPointsKronecker(const DataTable &samples)
+{
+    KroneckerSystem system;
+    return computeKroneckerSystem(samples, system) && solveKroneckerSystem(samples, system);
+}
+
+bool PSpline::computeKroneckerSystem(const DataTable &samples, KroneckerSystem &system) const
+{
+    if (!samples.isGridComplete())
+        return false;
+
+    computeCollocationMatrices(samples, system.B);
+
+    system.penaltyEigenvalues = DenseVector::Zero(1);
+
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        const SparseMatrix &B = system.B.at(i);
+        unsigned int n = B.cols();
+
+        // Need at least three coefficients in each variable
+        if (n < 3)
+            return false;
+
+        SparseMatrix D(n-2, n);
+        std::vector<Eigen::Triplet<double>> entries;
+        for (unsigned int j = 0; j < n-2; j++)
+        {
+            entries.push_back(Eigen::Triplet<double>(j, j, 1));
+            entries.push_back(Eigen::Triplet<double>(j, j+1, -2));
+            entries.push_back(Eigen::Triplet<double>(j, j+2, 1));
+        }
+        D.setFromTriplets(entries.begin(), entries.end());
+
+        system.G.push_back(B.transpose()*B);
+        system.P.push_back(D.transpose()*D);
+
+        Eigen::GeneralizedSelfAdjointEigenSolver<DenseMatrix> eigenSolver(system.P.back().toDense(), system.G.back().toDense());
+        if (eigenSolver.info() != Eigen::Success)
+            return false;
+
+        system.sampleDims.push_back(B.rows());
+        system.dims.push_back(n);
+        system.U.push_back(eigenSolver.eigenvectors());
+
+        // Kronecker sum (the last variable runs fastest)
+        const DenseVector &mu = eigenSolver.eigenvalues();
+        const DenseVector &s = system.penaltyEigenvalues;
+        DenseVector next(s.size()*n);
+        for (unsigned int k = 0; k < s.size(); k++)
+            for (unsigned int j = 0; j < n; j++)
+                next(k*n + j) = s(k) + mu(j);
+        system.penaltyEigenvalues = next;
+    }
+
+    return true;
+}
+
+bool PSpline::solveKroneckerSystem(const DataTable &samples, const KroneckerSystem &system)
+{
+    // Right-hand sides (sample y-values and x-values)
+    DenseMatrix Bx, By;
+    controlPointEquationRHS(samples, Bx, By);
+
+    DenseVector c;
+    if (!solveKroneckerSystem(system, By.col(0), c))
+        return false;
+    coefficients = c.transpose();
+
+    knotaverages.resize(numVariables, coefficients.cols());
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        DenseVector x;
+        if (!solveKroneckerSystem(system, Bx.col(i), x))
+            return false;
+        knotaverages.row(i) = x.transpose();
+    }
+
+    return true;
+}
+
+/*
+ * Computes the coefficients c that solve Lc = B'*y by preconditioned conjugate gradients,
+ * starting from c if it has the right size (a warm start)
+ */
+bool PSpline::solveKroneckerSystem(const KroneckerSystem &system, DenseVector y, DenseVector &c) const
+{
+    DenseVector eigenvalues = DenseVector::Ones(system.penaltyEigenvalues.size()) + lambda*system.penaltyEigenvalues;
+
+    auto applyL = [&](const DenseVector &x)
+    {
+        std::vector<unsigned int> dims = system.dims;
+        DenseVector result = x;
+        for (unsigned int i = 0; i < numVariables; i++)
+            tensorModeProduct(system.G.at(i), dims, i, result);
+
+        for (unsigned int i = 0; i < numVariables; i++)
+        {
+            DenseVector penalty = x;
+            tensorModeProduct(system.P.at(i), dims, i, penalty);
+            result += lambda*penalty;
+        }
+        return result;
+    };
+
+    auto applyPreconditioner = [&](DenseVector r)
+    {
+        std::vector<unsigned int> dims = system.dims;
+        for (unsigned int i = 0; i < numVariables; i++)
+            tensorModeProduct(DenseMatrix(system.U.at(i).transpose()), dims, i, r);
+
+        r = r.cwiseQuotient(eigenvalues);
+
+        for (unsigned int i = 0; i < numVariables; i++)
+            tensorModeProduct(system.U.at(i), dims, i, r);
+        return r;
+    };
+
+    // Right-hand side B'*y
+    std::vector<unsigned int> dims = system.sampleDims;
+    for (unsigned int i = 0; i < numVariables; i++)
+        tensorModeProduct(SparseMatrix(system.B.at(i).transpose()), dims, i, y);
+
+    ConjugateGradient solver;
+    return solver.solve(applyL, applyPreconditioner, y, c);
+}
+
+double PSpline::selectLambda(const DataTable &samples, const KroneckerSystem &system, SmoothingParameterSelection selection) const
+{
+    switch (selection)
+    {
+    case SmoothingParameterSelection::GCV:
+        return selectLambdaGCV(samples, system);
+    }
+
+    throw Exception("PSpline::selectLambda: Unknown smoothing parameter selection method.");
+}
+
+/*
+ * Selects the smoothing parameter that minimizes the generalized cross-validation score
+ *   GCV(l) = N*|y - H(l)*y|^2/(N - tr(H(l)))^2,
+ * where H(l) is the hat matrix of the fit. With the generalized eigenvectors P*V = G*V*S of the penalty
+ * and G = B'*B (V'*G*V = I), H = Q*(I + l*S)^-1*Q', where Q = B*V has orthonormal columns and S is diagonal.
+ * With z = Q'*y, computed once,
+ *   tr(H) = sum_k 1/(1 + l*s_k) and |y - H*y|^2 = |y|^2 - |z|^2 + sum_k (l*s_k/(1 + l*s_k))^2*z_k^2,
+ * so each candidate value costs O(n) operations. For up to maxNumExactCoefficients coefficients, V and S
+ * are computed from the dense G and P of the fit. For larger problems, the separable penalty of the
+ * preconditioner (see computeControlPointsKronecker) is used instead, for which V = U and S = M_1 + ... + M_d
+ * are known. This surrogate is exact for one variable. The score is evaluated on a logarithmic grid
+ * of candidate values, followed by a golden section search around the best candidate.
+ */
+double PSpline::selectLambdaGCV(const DataTable &samples, const KroneckerSystem &system) const
+{
+    std::vector<double> yv = samples.getVectorY();
+    DenseVector z = Eigen::Map<DenseVector>(yv.data(), yv.size());
+    double numSamples = z.size();
+    double yNorm2 = z.squaredNorm();
+
+    std::vector<unsigned int> dims = system.sampleDims;
+    for (unsigned int i = 0; i < numVariables; i++)
+        tensorModeProduct(SparseMatrix(system.B.at(i).transpose()), dims, i, z);
+
+    DenseVector s = system.penaltyEigenvalues;
+    bool exact = false;
+
+    const unsigned int maxNumExactCoefficients = 512;
+    if (s.size() <= maxNumExactCoefficients)
+    {
+        // G = G_1 x ... x G_d and P = P_1 x I x ... x I + ... + I x ... x I x P_d, built one variable at a time
+        SparseMatrix G(1, 1), P(1, 1);
+        G.insert(0, 0) = 1;
+        for (unsigned int i = 0; i < numVariables; i++)
+        {
+            SparseMatrix I(system.dims.at(i), system.dims.at(i)), J(G.rows(), G.cols());
+            I.setIdentity();
+            J.setIdentity();
+
+            SparseMatrix GG, PI, JP;
+            myKroneckerProduct(G, system.G.at(i), GG);
+            myKroneckerProduct(P, I, PI);
+            myKroneckerProduct(J, system.P.at(i), JP);
+            G = GG;
+            P = PI + JP;
+        }
+
+        Eigen::GeneralizedSelfAdjointEigenSolver<DenseMatrix> eigenSolver(P.toDense(), G.toDense());
+        if (eigenSolver.info() == Eigen::Success)
+        {
+            z = eigenSolver.eigenvectors().transpose()*z;
+            s = eigenSolver.eigenvalues();
+            exact = true;
+        }
+    }
+
+    if (!exact)
+    {
+        for (unsigned int i = 0; i < numVariables; i++)
+            tensorModeProduct(DenseMatrix(system.U.at(i).transpose()), dims, i, z);
+    }
+
+    double residual0 = std::max(yNorm2 - z.squaredNorm(), 0.0);
+
+    // GCV score as a function of log10(lambda)
+    auto gcv = [&](double logLambda)
+    {
+        double l = std::pow(10.0, logLambda);
+        double trace = 0;
+        double residual = residual0;
+        for (unsigned int k = 0; k < s.size(); k++)
+        {
+            double h = 1/(1 + l*s(k));
+            trace += h;
+            residual += (1 - h)*(1 - h)*z(k)*z(k);
+        }
+        double dof = numSamples - trace;
+        return numSamples*residual/(dof*dof);
+    };
+
+    const double minLogLambda = -8;
+    const double maxLogLambda = 4;
+    const unsigned int numCandidates = 50;
+    const double step = (maxLogLambda - minLogLambda)/(numCandidates - 1);
+
+    double bestLogLambda = minLogLambda;
+    double bestScore = gcv(minLogLambda);
+    for (unsigned int k = 1; k < numCandidates; k++)
+    {
+        double logLambda = minLogLambda + k*step;
+        double score = gcv(logLambda);
+        if (score < bestScore)
+        {
+            bestScore = score;
+            bestLogLambda = logLambda;
+        }
+    }
+
+    // Golden section search between the neighbouring candidates
+    const double ratio = (std::sqrt(5.0) - 1)/2;
+    double a = std::max(bestLogLambda - step, minLogLambda);
+    double b = std::min(bestLogLambda + step, maxLogLambda);
+    double c = b - ratio*(b - a);
+    double d = a + ratio*(b - a);
+    double fc = gcv(c), fd = gcv(d);
+
+    while (b - a > 1e-3)
+    {
+        if (fc < fd)
+        {
+            b = d;
+            d = c;
+            fd = fc;
+            c = b - ratio*(b - a);
+            fc = gcv(c);
+        }
+        else
+        {
+            a = c;
+            c = d;
+            fc = fd;
+            d = a + ratio*(b - a);
+            fd = gcv(d);
+        }
+    }
+
+    double logLambda = (a + b)/2;
+    if (gcv(logLambda) > bestScore)
+        logLambda = bestLogLambda;
+
+    return std::pow(10.0, logLambda);
+}
+
+/*
+ * Solves the P-spline equations (B'*W*B + l*D'*D)*c = B'*W*y for scattered samples
+ * with a sparse Cholesky (LDL') factorization. The knot averages are the Greville abscissae.
+ */
+void PSpline::computeControlPointsScattered(const DataTable &samples, const std::vector<double> &weights, unsigned int numThreads)
+{
+    SparseMatrix BWB, D;
+    DenseVector BWy;
+    computeNormalMatrix(samples, weights, numThreads, BWB, BWy);
+
+    getSecondOrderFiniteDifferenceMatrix(D);
+    SparseMatrix DD = D.transpose()*D;
+    SparseMatrix L = BWB + lambda*DD;
+
+    DenseMatrix R = BWy, C;
+    SparseLDLT s;
+    if (!s.solve(L, R, C))
+        throw Exception("PSpline::computeControlPointsScattered: Failed to solve for B-spline coefficients.");
+
+    coefficients = C.transpose();
+    computeKnotAverages();
+}
+
+/*
+ * Assembles B'*W*B and B'*W*y without forming B. Each sample x adds w*b(x)*b(x)' to B'*W*B,
+ * where b(x) has prod_i (p_i+1) nonzero entries. Entry (k,l) of B'*W*B can only be nonzero if
+ * |k_i - l_i| <= p_i in each variable, so row k is accumulated in a dense band of prod_i (2p_i+1)
+ * entries. The samples are split into one chunk per thread, each with its own band, and the bands
+ * are summed when the threads have finished.
+ */
+void PSpline::computeNormalMatrix(const DataTable &samples, const std::vector<double> &weights, unsigned int numThreads,
+                                  SparseMatrix &BWB, DenseVector &BWy) const
+{
+    if (!basis.fitsLocalBasis())
+        throw Exception("PSpline::computeNormalMatrix: Too many variables or too high basis degree.");
+
+    unsigned int numSamples = samples.getNumSamples();
+    unsigned int numBasisFunctions = basis.getNumBasisFunctions();
+
+    // Sizes and strides of the local basis, the band and the coefficients (last variable fastest)
+    std::vector<unsigned int> degrees = basis.getBasisDegrees();
+    std::vector<unsigned int> localStrides(numVariables), bandStrides(numVariables), coefficientStrides(numVariables);
+    unsigned int localSize = 1, bandSize = 1, numCoefficients = 1;
+    for (int i = numVariables - 1; i >= 0; i--)
+    {
+        localStrides.at(i) = localSize;
+        bandStrides.at(i) = bandSize;
+        coefficientStrides.at(i) = numCoefficients;
+        localSize *= degrees.at(i) + 1;
+        bandSize *= 2*degrees.at(i) + 1;
+        numCoefficients *= basis.getNumBasisFunctions(i);
+    }
+
+    // Band position of each pair of local basis functions, and the column offset of each band position
+    std::vector<unsigned int> pairOffsets(localSize*localSize);
+    for (unsigned int a = 0; a < localSize; a++)
+    {
+        for (unsigned int b = 0; b < localSize; b++)
+        {
+            unsigned int offset = 0;
+            for (unsigned int i = 0; i < numVariables; i++)
+            {
+                int ai = (a/localStrides.at(i)) % (degrees.at(i) + 1);
+                int bi = (b/localStrides.at(i)) % (degrees.at(i) + 1);
+                offset += (bi - ai + degrees.at(i))*bandStrides.at(i);
+            }
+            pairOffsets.at(a*localSize + b) = offset;
+        }
+    }
+
+    std::vector<int> columnOffsets(bandSize);
+    for (unsigned int o = 0; o < bandSize; o++)
+    {
+        int offset = 0;
+        for (unsigned int i = 0; i < numVariables; i++)
+            offset += ((int)((o/bandStrides.at(i)) % (2*degrees.at(i) + 1)) - (int)degrees.at(i))*(int)coefficientStrides.at(i);
+        columnOffsets.at(o) = offset;
+    }
+
+    // Copy the samples for random access
+    DenseMatrix X(numVariables, numSamples);
+    DenseVector y(numSamples);
+    unsigned int j = 0;
+    for (auto it = samples.cbegin(); it != samples.cend(); ++it, ++j)
+    {
+        std::vector<double> x = it->getX();
+        for (unsigned int i = 0; i < numVariables; i++)
+            X(i,j) = x.at(i);
+        y(j) = it->getY();
+    }
+
+    unsigned int numChunks = std::min(resolveNumThreads(numThreads), std::max(numSamples, 1u));
+    std::vector< std::vector<double> > bands(numChunks);
+    std::vector<DenseVector> rhs(numChunks);
+
+    parallelFor(0, numChunks, numChunks, [&](unsigned int firstChunk, unsigned int lastChunk)
+    {
+        LocalBasis local;
+        std::vector<unsigned int> indices;
+        std::vector<double> values;
+
+        for (unsigned int chunk = firstChunk; chunk < lastChunk; chunk++)
+        {
+            std::vector<double> &band = bands.at(chunk);
+            DenseVector &r = rhs.at(chunk);
+            band.assign((size_t)numBasisFunctions*bandSize, 0);
+            r = DenseVector::Zero(numBasisFunctions);
+
+            unsigned int begin = (unsigned int)(((unsigned long long)numSamples*chunk)/numChunks);
+            unsigned int end = (unsigned int)(((unsigned long long)numSamples*(chunk+1))/numChunks);
+
+            for (unsigned int s = begin; s < end; s++)
+            {
+                DenseVector x = X.col(s);
+                if (!basis.insideSupport(x))
+                    throw Exception("PSpline::computeNormalMatrix: Sample outside the support of the basis functions.");
+
+                basis.evalLocal(x, local);
+                basis.expandLocal(local, indices, values);
+
+                double w = weights.empty() ? 1 : weights.at(s);
+
+                for (unsigned int a = 0; a < localSize; a++)
+                {
+                    double wa = w*values[a];
+                    r(indices[a]) += wa*y(s);
+
+                    double *row = band.data() + (size_t)indices[a]*bandSize;
+                    const unsigned int *offsets = pairOffsets.data() + a*localSize;
+                    for (unsigned int b = 0; b < localSize; b++)
+                        row[offsets[b]] += wa*values[b];
+                }
+            }
+        }
+    });
+
+    for (unsigned int chunk = 1; chunk < numChunks; chunk++)
+    {
+        std::vector<double> &band = bands.at(chunk);
+        for (size_t k = 0; k < band.size(); k++)
+            bands.at(0)[k] += band[k];
+        rhs.at(0) += rhs.at(chunk);
+        std::vector<double>().swap(band);
+    }
+
+    std::vector<Eigen::Triplet<double>> entries;
+    const std::vector<double> &band = bands.at(0);
+    for (unsigned int k = 0; k < numBasisFunctions; k++)
+    {
+        for (unsigned int o = 0; o < bandSize; o++)
+        {
+            double value = band[(size_t)k*bandSize + o];
+            if (value != 0)
+                entries.push_back(Eigen::Triplet<double>(k, k + columnOffsets.at(o), value));
+        }
+    }
+
+    BWB.resize(numBasisFunctions, numBasisFunctions);
+    BWB.setFromTriplets(entries.begin(), entries.end());
+    BWB.makeCompressed();
+
+    BWy = rhs.at(0);
 }
 
 // Function for generating second order finite-difference matrix, which is used for penalizing the
@@ -9,46 +9,181 @@
 
 #include "radialbasisfunction.h"
 #include "linearsolvers.h"
-#include "Eigen/SVD"
+#include "kdtree.h"
+#include "Eigen/Cholesky"
+#include "Eigen/LU"
+#include "Eigen/QR"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 namespace SPLINTER
 {
 
+/*
+ * Estimate of the reciprocal condition number 1/(|A|_1 |A^-1|_1) by Hager's method (as in LAPACK's xGECON),
+ * where solve(y) returns A^-1 y and solveTransposed(y) returns A^-T y. With a factorization of A,
+ * each iteration costs a few triangular solves, so the estimate is O(n^2) instead of the O(n^3) of an SVD.
+ */
+template<class Solve, class SolveTransposed>
+static double estimateReciprocalCondition(const DenseMatrix &A, Solve solve, SolveTransposed solveTransposed)
+{
+    unsigned int n = A.rows();
+    double normA = A.cwiseAbs().colwise().sum().maxCoeff();
+    if (n == 0 || normA == 0)
+        return 0.0;
+
+    DenseVector x = DenseVector::Constant(n, 1.0/n);
+    double normInverse = 0;
+
+    for (unsigned int k = 0; k < 5; k++)
+    {
+        DenseVector y = solve(x);
+        double estimate = y.lpNorm<1>();
+
+        // An exactly singular factorization gives infinite or undefined solutions
+        if (!std::isfinite(estimate))
+            return 0.0;
+        if (k > 0 && estimate <= normInverse)
+            break;
+        normInverse = estimate;
+
+        Eigen::ArrayXd signs = (y.array() < 0).select(Eigen::ArrayXd::Constant(n, -1.0), Eigen::ArrayXd::Ones(n));
+        DenseVector z = solveTransposed(signs.matrix());
+
+        DenseVector::Index j;
+        z.cwiseAbs().maxCoeff(&j);
+        if (k > 0 && std::abs(z(j)) <= z.dot(x))
+            break;
+        x = DenseVector::Unit(n, j);
+    }
+
+    // Higham's alternating sign vector catches the matrices where the iteration above underestimates |A^-1|
+    DenseVector alternating(n);
+    for (unsigned int i = 0; i < n; i++)
+        alternating(i) = (i % 2 == 0 ? 1 : -1)*(1 + i/std::max(n - 1.0, 1.0));
+
+    double estimate = 2*solve(alternating).template lpNorm<1>()/(3*n);
+    if (!std::isfinite(estimate))
+        return 0.0;
+    normInverse = std::max(normInverse, estimate);
+
+    return 1.0/(normA*normInverse);
+}
+
+// Reciprocal condition number estimate of A from its LU factorization (PA = LU, so A^-T y = P^T L^-T U^-T y)
+static double estimateReciprocalCondition(const DenseMatrix &A, const Eigen::PartialPivLU<DenseMatrix> &lu)
+{
+    return estimateReciprocalCondition(A,
+        [&lu](const DenseVector &y) -> DenseVector
+        {
+            return lu.solve(y);
+        },
+        [&lu](const DenseVector &y) -> DenseVector
+        {
+            DenseVector z = lu.matrixLU().triangularView<Eigen::Upper>().transpose().solve(y);
+            z = lu.matrixLU().triangularView<Eigen::UnitLower>().transpose().solve(z);
+            return lu.permutationP().transpose()*z;
+        });
+}
+
+/*
+ * Solve the interpolation system A*w = b.
+ * Positive definite kernels give a symmetric positive definite matrix, which is factorized by Cholesky.
+ * If A is numerically semidefinite (as with wide Gaussians), its diagonal is shifted by the backward error
+ * of the factorization, falling back to the pivoted LDLT factorization if Cholesky still fails.
+ * The other kernels give symmetric indefinite matrices, which are factorized by LU with partial pivoting.
+ * The LU factorization comes with an O(n^2) estimate of the reciprocal condition number (rcond). If it is below
+ * machine precision (the thin-plate spline gives singular matrices, e.g. for samples a distance of 1 apart),
+ * the weights are computed by the rank revealing QR factorization with column pivoting instead, which costs
+ * about as much as the LU factorization. The estimates of the symmetric factorizations are only computed
+ * in debug builds.
+ */
+static DenseMatrix solveInterpolationSystem(const DenseMatrix &A, const DenseMatrix &b, bool positiveDefinite, double &rcond)
+{
+    rcond = 0;
+
+    if (positiveDefinite)
+    {
+        // If A is numerically semidefinite, a shift of the diagonal by n*eps*max|A_ii|, the size of the backward
+        // error of the Cholesky factorization, keeps its rounding errors from inflating the weights
+        DenseMatrix shifted;
+        Eigen::LLT<DenseMatrix> llt(A);
+        if (llt.info() != Eigen::Success)
+        {
+            shifted = A;
+            shifted.diagonal().array() += A.rows()*std::numeric_limits<double>::epsilon()*A.diagonal().cwiseAbs().maxCoeff();
+            llt.compute(shifted);
+        }
+
+        if (llt.info() == Eigen::Success)
+        {
+#ifndef NDEBUG
+            auto solve = [&llt](const DenseVector &y) -> DenseVector { return llt.solve(y); };
+            rcond = estimateReciprocalCondition(A, solve, solve);
+#endif // NDEBUG
+
+            return llt.solve(b);
+        }
+
+        Eigen::LDLT<DenseMatrix> ldlt(shifted);
+
+#ifndef NDEBUG
+        auto solve = [&ldlt](const DenseVector &y) -> DenseVector { return ldlt.solve(y); };
+        rcond = estimateReciprocalCondition(shifted, solve, solve);
+#endif // NDEBUG
+
+        return ldlt.solve(b);
+    }
+
+    Eigen::PartialPivLU<DenseMatrix> lu(A);
+    rcond = estimateReciprocalCondition(A, lu);
+
+    if (rcond <= std::numeric_limits<double>::epsilon())
+        return A.colPivHouseholderQr().solve(b);
+
+    return lu.solve(b);
+}
+
 RadialBasisFunction::RadialBasisFunction(const DataTable &samples, RadialBasisFunctionType type)
     : RadialBasisFunction(samples, type, false)
 {
 }
 
 RadialBasisFunction::RadialBasisFunction(const DataTable &samples, RadialBasisFunctionType type, bool normalized)
-    : samples(samples),
-      normalized(normalized),
-      precondition(false),
+    : RadialBasisFunction(samples, type, normalized, false)
+{
+}
+
+RadialBasisFunction::RadialBasisFunction(const DataTable &samples, RadialBasisFunctionType type, bool normalized, bool precondition)
+    : normalized(normalized),
+      precondition(precondition),
       dim(samples.getNumVariables()),
       numSamples(samples.getNumSamples())
 {
     if (type == RadialBasisFunctionType::THIN_PLATE_SPLINE)
     {
-        fn = std::shared_ptr<RadialBasisFunctionTerm>(new ThinPlateSpline());
+        setKernel<ThinPlateSplineKernel>();
     }
     else if (type == RadialBasisFunctionType::MULTIQUADRIC)
     {
-        fn = std::shared_ptr<RadialBasisFunctionTerm>(new Multiquadric());
+        setKernel<MultiquadricKernel>();
     }
     else if (type == RadialBasisFunctionType::INVERSE_QUADRIC)
     {
-        fn = std::shared_ptr<RadialBasisFunctionTerm>(new InverseQuadric());
+        setKernel<InverseQuadricKernel>();
     }
     else if (type == RadialBasisFunctionType::INVERSE_MULTIQUADRIC)
     {
-        fn = std::shared_ptr<RadialBasisFunctionTerm>(new InverseMultiquadric());
+        setKernel<InverseMultiquadricKernel>();
     }
     else if (type == RadialBasisFunctionType::GAUSSIAN)
     {
-        fn = std::shared_ptr<RadialBasisFunctionTerm>(new Gaussian());
+        setKernel<GaussianKernel>();
     }
     else
     {
-        fn = std::shared_ptr<RadialBasisFunctionTerm>(new ThinPlateSpline());
+        setKernel<ThinPlateSplineKernel>();
     }
 
     /* Want to solve the linear system A*w = b,
@@ -63,61 +198,86 @@ RadialBasisFunction::RadialBasisFunction(const DataTable &samples, RadialBasisFu
     DenseMatrix A; A.setZero(numSamples, numSamples);
     DenseMatrix b; b.setZero(numSamples,1);
 
+    centers.resize(numSamples, dim);
     int i=0;
-    for (auto it1 = samples.cbegin(); it1 != samples.cend(); ++it1, ++i)
+    for (auto it = samples.cbegin(); it != samples.cend(); ++it, ++i)
     {
-        double sum = 0;
-        int j=0;
-        for (auto it2 = samples.cbegin(); it2 != samples.cend(); ++it2, ++j)
-        {
-            double val = fn->eval(dist(*it1, *it2));
-            if (val != 0)
-            {
-                //A.insert(i,j) = val;
-                A(i,j) = val;
-                sum += val;
-            }
-        }
+        auto x = it->getX();
+        for (unsigned int k = 0; k < dim; k++)
+            centers(i,k) = x.at(k);
+    }
+
+    origin = centers.colwise().mean().transpose();
+    centers.rowwise() -= origin.transpose();
+    centerSquaredNorms = centers.rowwise().squaredNorm().array();
+
+    (this->*assemble)(A);
 
-        double y = it1->getY();
-        if (normalized) b(i) = sum*y;
+    i=0;
+    for (auto it = samples.cbegin(); it != samples.cend(); ++it, ++i)
+    {
+        double y = it->getY();
+        if (normalized) b(i) = A.row(i).sum()*y;
         else b(i) = y;
     }
 
     //A.makeCompressed();
 
+#ifndef NDEBUG
+    std::cout << "Computing RBF weights using dense solver." << std::endl;
+#endif // NDEBUG
+
+    /* Solve for weights (see solveInterpolationSystem).
+     * The preconditioned system P*A*w = P*b is factorized by LU with partial pivoting. Its solution is refined
+     * against the original system until the backward error is at machine precision (as in LAPACK's xGERFS).
+     * If P*A is numerically singular, or the refinement stagnates, the original system is solved instead.
+     */
+    double rcond = 0;
+
     if (precondition)
     {
-        // Calcualte precondition matrix P
-        DenseMatrix P = computePreconditionMatrix();
+        // Calculate precondition matrix P
+        SparseMatrix P = computePreconditionMatrix();
 
         // Preconditioned A and b
-        DenseMatrix Ap = P*A;
-        DenseMatrix bp = P*b;
+        DenseMatrix PA = P*A;
+        Eigen::PartialPivLU<DenseMatrix> lu(PA);
+        rcond = estimateReciprocalCondition(PA, lu);
 
-        A = Ap;
-        b = bp;
-    }
+        bool converged = false;
 
-#ifndef NDEBUG
-    std::cout << "Computing RBF weights using dense solver." << std::endl;
-#endif // NDEBUG
+        if (rcond > std::numeric_limits<double>::epsilon())
+        {
+            weights = lu.solve(P*b);
 
-    // SVD analysis
-    Eigen::JacobiSVD<DenseMatrix> svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
-    auto svals = svd.singularValues();
-    double svalmax = svals(0);
-    double svalmin = svals(svals.rows()-1);
-    double rcondnum = (svalmax <= 0.0 || svalmin <= 0.0) ? 0.0 : svalmin/svalmax;
+            // The local ACBF weights are large when the kernel is flat, which costs accuracy in P*A
+            const unsigned int maxNumRefinements = 5;
+            double normA = A.cwiseAbs().rowwise().sum().maxCoeff();
+
+            for (unsigned int k = 0; k <= maxNumRefinements && !converged; k++)
+            {
+                DenseMatrix residual = b - A*weights;
+                converged = residual.lpNorm<Eigen::Infinity>()
+                            <= std::numeric_limits<double>::epsilon()*(normA*weights.lpNorm<Eigen::Infinity>() + b.lpNorm<Eigen::Infinity>());
+
+                if (!converged && k < maxNumRefinements)
+                    weights += lu.solve(P*residual);
+            }
+        }
+
+        // P*A is numerically singular, or too inaccurate for the refinement to converge
+        if (!converged)
+            weights = solveInterpolationSystem(A, b, fn->isPositiveDefinite(), rcond);
+    }
+    else
+    {
+        weights = solveInterpolationSystem(A, b, fn->isPositiveDefinite(), rcond);
+    }
 
 #ifndef NDEBUG
-    std::cout << "The reciprocal of the condition number is: " << rcondnum << std::endl;
-    std::cout << "Largest/smallest singular value: " << svalmax << " / " << svalmin << std::endl;
+    std::cout << "The estimated reciprocal of the condition number is: " << rcond << std::endl;
 #endif // NDEBUG
 
-    // Solve for weights
-    weights = svd.solve(b);
-
 #ifndef NDEBUG
     // Compute error. If it is used later on, move this statement above the NDEBUG
     double err = (A*weights - b).norm() / b.norm();
@@ -132,26 +292,133 @@ RadialBasisFunction::RadialBasisFunction(const DataTable &samples, RadialBasisFu
     // NOTE: Tried using experimental GMRES solver in Eigen, but it did not work very well.
 }
 
-double RadialBasisFunction::eval(DenseVector x) const
+double RadialBasisFunction::eval(const DenseVector &x) const
 {
-    std::vector<double> y;
-    for (int i=0; i<x.rows(); i++)
-        y.push_back(x(i));
-    return eval(y);
+    assert(x.size() == dim);
+    return (this->*evaluate)(x);
 }
 
 double RadialBasisFunction::eval(std::vector<double> x) const
 {
-    assert(x.size() == dim);
-    double fval, sum = 0, sumw = 0;
-    int i = 0;
-    for (auto it = samples.cbegin(); it != samples.cend(); ++it, ++i)
+    DenseVector y(x.size());
+    for (unsigned int i=0; i<x.size(); i++)
+        y(i) = x.at(i);
+    return eval(y);
+}
+
+void RadialBasisFunction::computeSquaredDistances(const DenseVector &x, Eigen::ArrayXd &r2) const
+{
+    r2 = (centers.col(0).array() - (x(0) - origin(0))).square();
+    for (unsigned int k = 1; k < dim; k++)
+        r2 += (centers.col(k).array() - (x(k) - origin(k))).square();
+}
+
+void RadialBasisFunction::evalBatchRange(const DenseMatrix &x, PointLayout layout,
+                                         unsigned int begin, unsigned int end, DenseVector &y) const
+{
+    (this->*evaluateBatch)(x, layout, begin, end, y);
+}
+
+template<class Kernel>
+void RadialBasisFunction::setKernel()
+{
+    fn = std::shared_ptr<RadialBasisFunctionTerm>(new RadialBasisFunctionKernel<Kernel>());
+    assemble = &RadialBasisFunction::assembleMatrix<Kernel>;
+    evaluate = &RadialBasisFunction::evalKernel<Kernel>;
+    evaluateBatch = &RadialBasisFunction::evalBatchKernel<Kernel>;
+}
+
+/*
+ * A is symmetric, so only its upper triangle is evaluated (one column at a time) and then mirrored.
+ * The distances are taken between the stored centers, which is what eval computes at a sample.
+ */
+template<class Kernel>
+void RadialBasisFunction::assembleMatrix(DenseMatrix &A) const
+{
+    double e = fn->getShapeParameter();
+    Eigen::ArrayXd r2, values;
+
+    for (unsigned int j = 0; j < numSamples; j++)
     {
-        fval = fn->eval(dist(x,it->getX()));
-        sumw += weights(i)*fval;
-        sum += fval;
+        r2 = (centers.col(0).head(j + 1).array() - centers(j,0)).square();
+        for (unsigned int k = 1; k < dim; k++)
+            r2 += (centers.col(k).head(j + 1).array() - centers(j,k)).square();
+
+        Kernel::evalArray(r2, e, values);
+        A.col(j).head(j + 1) = values.matrix();
+    }
+
+    A.triangularView<Eigen::StrictlyLower>() = A.transpose();
+}
+
+template<class Kernel>
+double RadialBasisFunction::evalKernel(const DenseVector &x) const
+{
+    Eigen::ArrayXd r2, values;
+    computeSquaredDistances(x, r2);
+    Kernel::evalArray(r2, fn->getShapeParameter(), values);
+
+    double sumw = (weights.col(0).array()*values).sum();
+    return normalized ? sumw/values.sum() : sumw;
+}
+
+/*
+ * The blocks are sized so that the products, squared distances and kernel values of a pair of blocks
+ * (numPoints x numCenters each) stay in the L2 cache between the three passes over them
+ */
+template<class Kernel>
+void RadialBasisFunction::evalBatchKernel(const DenseMatrix &x, PointLayout layout,
+                                          unsigned int begin, unsigned int end, DenseVector &y) const
+{
+    const unsigned int pointBlockSize = 64;
+    const unsigned int centerBlockSize = 64;
+    double e = fn->getShapeParameter();
+
+    DenseVector xi(dim);
+    DenseMatrix products;
+    Eigen::ArrayXXd r2, values;
+
+    // A block always has pointBlockSize rows (the last one is padded with zeros, i.e. the origin), so that the
+    // matrix-vector product below treats every row alike and the result of a point does not depend on the other
+    // points of the block (nor on how the batch is split between threads)
+    DenseMatrix X = DenseMatrix::Zero(pointBlockSize, dim);
+
+    for (unsigned int p = begin; p < end; p += pointBlockSize)
+    {
+        unsigned int numPoints = std::min(pointBlockSize, end - p);
+
+        for (unsigned int i = 0; i < numPoints; i++)
+        {
+            getBatchPoint(x, layout, p + i, xi);
+            X.row(i) = (xi - origin).transpose();
+        }
+        X.bottomRows(pointBlockSize - numPoints).setZero();
+        Eigen::ArrayXd pointSquaredNorms = X.rowwise().squaredNorm().array();
+
+        DenseVector sumw = DenseVector::Zero(pointBlockSize);
+        DenseVector sum = DenseVector::Zero(pointBlockSize);
+
+        for (unsigned int c = 0; c < numSamples; c += centerBlockSize)
+        {
+            unsigned int numCenters = std::min(centerBlockSize, numSamples - c);
+
+            products.noalias() = X*centers.middleRows(c, numCenters).transpose();
+
+            // Rounding may make the squared distances slightly negative
+            r2.resize(pointBlockSize, numCenters);
+            for (unsigned int j = 0; j < numCenters; j++)
+                r2.col(j) = (pointSquaredNorms + (centerSquaredNorms(c + j) - 2*products.col(j).array())).max(0.0);
+
+            Kernel::evalArray(r2, e, values);
+
+            sumw.noalias() += values.matrix()*weights.col(0).segment(c, numCenters);
+            if (normalized)
+                sum += values.rowwise().sum().matrix();
+        }
+
+        for (unsigned int i = 0; i < numPoints; i++)
+            y(p + i) = normalized ? sumw(i)/sum(i) : sumw(i);
     }
-    return normalized ? sumw/sum : sumw;
 }
 
 /*
@@ -207,127 +474,79 @@ double RadialBasisFunction::eval(std::vector<double> x) const
 //}
 
 /*
- * Calculate precondition matrix
+ * Calculate precondition matrix P based on purely local approximate cardinal basis functions (ACBF).
+ * Row i of P holds the weights of the kernels centered at the points closest to sample i (found with a k-d tree)
+ * and at one point far away from it, chosen so that the local interpolant is one at sample i and zero at the
+ * other points. P has a fixed number of nonzeros per row, so P*A costs O(N^2) instead of O(N^3).
  */
-DenseMatrix RadialBasisFunction::computePreconditionMatrix() const
+SparseMatrix RadialBasisFunction::computePreconditionMatrix() const
 {
-    DenseMatrix P;
-    P.setZero(numSamples,numSamples);
+    // Local points to consider (including sample i)
+    unsigned int numLocalPoints = std::min(numSamples, std::max(16u, 2*(dim + 1)));
 
-    // Calculate precondition matrix P based on
-    // purely local approximate cardinal basis functions (ACBF)
-    int sigma = std::max(1.0, std::floor(0.1*numSamples)); // Local points to consider
+    KdTree tree(centers);
 
-    int i=0;
-    for (auto it1 = samples.cbegin(); it1 != samples.cend(); ++it1, ++i)
+    // Far points are taken among the samples that are extreme in some variable, which lie on the boundary of the domain
+    std::vector<unsigned int> extremes;
+    for (unsigned int k = 0; k < dim; k++)
     {
-        Point p1(it1->getX());
+        DenseMatrix::Index imin, imax;
+        centers.col(k).minCoeff(&imin);
+        centers.col(k).maxCoeff(&imax);
+        extremes.push_back(imin);
+        extremes.push_back(imax);
+    }
 
-        // Shift data using p1 as origin
-        std::vector<Point> shifted_points;
-        int j=0;
-        for (auto it2 = samples.cbegin(); it2 != samples.cend(); ++it2, ++j)
-        {
-            Point p2(it2->getX());
-            Point p3(p2-p1);
-            p3.setIndex(j); // store index with point
-            shifted_points.push_back(p3);
-        }
-        std::sort(shifted_points.begin(), shifted_points.end());
+    std::vector<Eigen::Triplet<double>> entries;
+    entries.reserve(numSamples*(numLocalPoints + 1));
 
-        // Find sigma closest points to p1
-        std::vector<Point> points;
-        std::vector<int> indices;
-        for (int j=0; j<sigma; j++)
-        {
-            Point p(shifted_points.at(j));
-            indices.push_back(p.getIndex());
-            Point p2 = p+p1;
-            p2.setIndex(p.getIndex());
-            points.push_back(p2); // The resulting point has a different index than that of p
-//                cout << p.getIndex() << "/" << p1.getIndex() << "/" << p2.getIndex() << endl;
-//                assert(p.getIndex() == p2.getIndex());
-        }
-
-        // Add some points far away from p1 and preferably scattered around the domain boundary
-        for (int k=0; k<1; k++)
+    for (unsigned int i = 0; i < numSamples; i++)
+    {
+        DenseVector xi = centers.row(i).transpose();
+        std::vector<unsigned int> indices = tree.nearest(xi, numLocalPoints);
+
+        // Sample i is its own nearest neighbour, unless some samples are equal
+        auto it = std::find(indices.begin(), indices.end(), i);
+        if (it == indices.end())
+            indices.back() = i;
+        std::iter_swap(indices.begin(), std::find(indices.begin(), indices.end(), i));
+
+        // Add the extreme sample farthest from sample i, if it is not already a neighbour
+        unsigned int farthest = extremes.front();
+        for (auto k : extremes)
         {
-            Point p(shifted_points.at(shifted_points.size()-1-k));
-            indices.push_back(p.getIndex());
-            Point p2 = p+p1;
-            p2.setIndex(p.getIndex());
-            points.push_back(p2);
+            if ((centers.row(k) - centers.row(i)).squaredNorm() > (centers.row(farthest) - centers.row(i)).squaredNorm())
+                farthest = k;
         }
+        if (std::find(indices.begin(), indices.end(), farthest) == indices.end())
+            indices.push_back(farthest);
 
-        // Build and solve linear system
-        int m = points.size();
+        // Build and solve the local interpolation problem B*w = e
+        unsigned int m = indices.size();
 
-        DenseMatrix e; e.setZero(m,1); e(0,0) = 1;
-        DenseMatrix B; B.setZero(m,m);
-        DenseMatrix w; w.setZero(m,1);
+        DenseMatrix B(m, m);
+        DenseVector e = DenseVector::Zero(m); e(0) = 1;
 
-        assert(points.front().getIndex() == i);
-
-        for (int k1=0; k1<m; k1++)
+        for (unsigned int k1 = 0; k1 < m; k1++)
         {
-            for (int k2=0; k2<m; k2++)
+            for (unsigned int k2 = 0; k2 <= k1; k2++)
             {
-                Point p = points.at(k1) - points.at(k2);
-                B(k1,k2) = fn->eval(p.dist());
+                B(k1,k2) = fn->eval((centers.row(indices.at(k1)) - centers.row(indices.at(k2))).norm());
+                B(k2,k1) = B(k1,k2);
             }
         }
-//            DenseQR s;
-//            bool success = s.solve(B,e,w);
-//            assert(success);
-
-        Eigen::JacobiSVD<DenseMatrix> svd(B, Eigen::ComputeThinU | Eigen::ComputeThinV);
-        w = svd.solve(e);
-        //assert(svd.info() == Eigen::Success);
 
-        for (unsigned int j=0; j<numSamples; j++)
-        {
-            auto it = find(indices.begin(),indices.end(),j);
-            if (it!=indices.end())
-            {
-                int k = it - indices.begin();
+        // Rank revealing, since the local points may be nearly degenerate
+        DenseVector w = B.colPivHouseholderQr().solve(e);
 
-                P(i,j) = w(k,0);
-                //cout << "j/k/g " << j << "/" << k << "/" << points.at(k).getIndex() << endl;
-                assert(points.at(k).getIndex()==j);
-            }
-        }
+        for (unsigned int k = 0; k < m; k++)
+            entries.push_back(Eigen::Triplet<double>(i, indices.at(k), w(k)));
     }
 
-    return P;
-}
+    SparseMatrix P(numSamples, numSamples);
+    P.setFromTriplets(entries.begin(), entries.end());
 
-/*
- * Computes Euclidean distance ||x-y||
- */
-double RadialBasisFunction::dist(std::vector<double> x, std::vector<double> y) const
-{
-    assert(x.size() == y.size());
-    double sum = 0.0;
-    for (unsigned int i=0; i<x.size(); i++)
-        sum += (x.at(i)-y.at(i))*(x.at(i)-y.at(i));
-    return std::sqrt(sum);
-}
-
-/*
- * Computes Euclidean distance ||x-y||
- */
-double RadialBasisFunction::dist(DataSample x, DataSample y) const
-{
-    return dist(x.getX(), y.getX());
-}
-
-bool RadialBasisFunction::dist_sort(DataSample x, DataSample y) const
-{
-    std::vector<double> zeros(x.getDimX(), 0);
-    DataSample origin(zeros, 0.0);
-    double x_dist = dist(x, origin);
-    double y_dist = dist(y, origin);
-    return (x_dist<y_dist);
+    return P;
 }
 
 } // namespace SPLINTER
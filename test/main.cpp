@@ -19,7 +19,14 @@
 
 #include "bspline.h"
 #include "pspline.h"
+#include "bsplinefitter.h"
+#include "bsplineview.h"
+#include "linearsolvers.h"
+#include "mykroneckerproduct.h"
+#include "unsupported/Eigen/KroneckerProduct"
+#include "piecewisepolynomial.h"
 #include "radialbasisfunction.h"
+#include "kdtree.h"
 #include "testingutilities.h"
 
 using std::cout;
@@ -230,121 +237,1457 @@ void runRecursiveDomainReductionTest()
         cout << "Test failed!" << endl;
 }
 
+/*
+ * Recursive domain reduction with views of one B-spline. Every view must evaluate as the
+ * B-spline, and materialize must give the same control points as BSpline::reduceDomain.
+ */
+bool bsplineViewTest(const BSplineView &view, const BSpline &bs, unsigned int depth)
+{
+    BSpline reduced(view.getBSpline());
+    reduced.reduceDomain(view.getDomainLowerBound(), view.getDomainUpperBound());
+
+    BSpline materialized = view.materialize();
+
+    DenseMatrix difference = materialized.getControlPoints() - reduced.getControlPoints();
+    if (materialized.getKnotVectors() != reduced.getKnotVectors() || difference.cwiseAbs().maxCoeff() > 1e-12)
+        return false;
+
+    auto lb = view.getDomainLowerBound();
+    auto ub = view.getDomainUpperBound();
+
+    DenseVector x(2);
+    for (auto t : linspace(0, 1, 7))
+    {
+        x(0) = (1 - t)*lb.at(0) + t*ub.at(0);
+        x(1) = t*lb.at(1) + (1 - t)*ub.at(1);
+
+        if (view.eval(x) != bs.eval(x) || std::abs(materialized.eval(x) - bs.eval(x)) > 1e-10)
+            return false;
+    }
+
+    if (depth == 0)
+        return true;
+
+    unsigned int index = depth % 2;
+    auto split = (ub.at(index) + lb.at(index))/2;
+
+    auto ub2 = ub; ub2.at(index) = split;
+    auto lb3 = lb; lb3.at(index) = split;
+
+    return bsplineViewTest(view.reduceDomain(lb, ub2), bs, depth - 1)
+        && bsplineViewTest(view.reduceDomain(lb3, ub), bs, depth - 1);
+}
+
+void testBSplineView()
+{
+    cout << endl << endl;
+    cout << "Testing B-spline views..." << endl;
+
+    DataTable samples;
+    DenseVector x(2);
+
+    for (auto x0 : linspace(0, 2, 20))
+    {
+        for (auto x1 : linspace(0, 2, 20))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, sixHumpCamelBack(x));
+        }
+    }
+
+    BSpline bspline(samples, BSplineType::CUBIC);
+
+    // Views of an odd box that does not align with the knots
+    BSplineView view(bspline);
+    BSplineView box = view.reduceDomain({0.13, 0.41}, {1.77, 1.9});
+
+    if (box.getNumBasisFunctions().at(0) >= bspline.getNumBasisFunctions().at(0))
+    {
+        cout << "Test failed - the view has too many basis functions" << endl;
+        return;
+    }
+
+    if (bsplineViewTest(view, bspline, 5) && bsplineViewTest(box, bspline, 4))
+        cout << "Test finished successfully!" << endl;
+    else
+        cout << "Test failed!" << endl;
+}
+
+/*
+ * The bounds over a box must enclose the B-spline values on the box, and the tight
+ * bounds must lie within the coefficient bounds and approach the range of the B-spline.
+ */
+void testBSplineBounds()
+{
+    cout << endl << endl;
+    cout << "Testing B-spline bounds..." << endl;
+
+    DataTable samples;
+    DenseVector x(2);
+
+    for (auto x0 : linspace(-1, 1, 15))
+    {
+        for (auto x1 : linspace(-1, 1, 15))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, sixHumpCamelBack(x));
+        }
+    }
+
+    BSpline bspline(samples, BSplineType::CUBIC);
+
+    for (double width : {2.0, 0.7, 0.1, 0.01})
+    {
+        std::vector<double> lb = {-0.9, 0.05}, ub = {-0.9 + 0.9*width, 0.05 + 0.45*width};
+
+        double lower, upper, tightLower, tightUpper;
+        bspline.bounds(lb, ub, lower, upper);
+        bspline.bounds(lb, ub, tightLower, tightUpper, true);
+
+        double minValue = 1e100, maxValue = -1e100;
+        for (auto x0 : linspace(lb.at(0), ub.at(0), 11))
+        {
+            for (auto x1 : linspace(lb.at(1), ub.at(1), 11))
+            {
+                x(0) = std::min(x0, ub.at(0));
+                x(1) = std::min(x1, ub.at(1));
+                double y = bspline.eval(x);
+                minValue = std::min(minValue, y);
+                maxValue = std::max(maxValue, y);
+            }
+        }
+
+        if (lower > tightLower + 1e-12 || tightLower > minValue + 1e-12
+            || upper < tightUpper - 1e-12 || tightUpper < maxValue - 1e-12)
+        {
+            cout << "Test failed - invalid bounds on box of width " << width << endl;
+            return;
+        }
+
+        if (width < 0.05 && (tightUpper - tightLower) > 1.5*(maxValue - minValue) + 1e-10)
+        {
+            cout << "Test failed - the tight bounds are too loose" << endl;
+            return;
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * The RBF weights are computed by Cholesky for the positive definite kernels and by LU for
+ * the others (with a rank revealing fallback for singular systems). For every kernel, the RBF must
+ * interpolate the (scattered) samples (to a tolerance that allows for the poor conditioning of the
+ * Gaussian kernel, whose matrix is numerically singular), and the blocked batch evaluation must agree with eval.
+ */
+void testRadialBasisFunctionSolvers()
+{
+    cout << endl << endl;
+    cout << "Testing radial basis function solvers..." << endl;
+
+    // Pseudo-random points (linear congruential generator)
+    unsigned int seed = 9753;
+    auto random = [&seed]()
+    {
+        seed = 1103515245*seed + 12345;
+        return ((seed >> 8) % 100000)/100000.0;
+    };
+
+    DataTable samples;
+    DenseVector x(2);
+
+    for (unsigned int k = 0; k < 150; k++)
+    {
+        x(0) = -1 + 2*random();
+        x(1) = 2*random();
+        samples.addSample(x, sixHumpCamelBack(x));
+    }
+
+    for (auto type : {RadialBasisFunctionType::THIN_PLATE_SPLINE, RadialBasisFunctionType::MULTIQUADRIC,
+                      RadialBasisFunctionType::INVERSE_QUADRIC, RadialBasisFunctionType::INVERSE_MULTIQUADRIC,
+                      RadialBasisFunctionType::GAUSSIAN})
+    {
+        for (bool normalized : {false, true})
+        {
+            RadialBasisFunction rbf(samples, type, normalized);
+
+            for (auto it = samples.cbegin(); it != samples.cend(); ++it)
+            {
+                if (!assertNear(rbf.eval(it->getX()), it->getY(), 1e-5, 1e-5))
+                {
+                    cout << "Test failed - the RBF does not interpolate the samples" << endl;
+                    return;
+                }
+            }
+
+            // The sparse ACBF preconditioner must not change the interpolant
+            RadialBasisFunction rbfPreconditioned(samples, type, normalized, true);
+
+            for (auto it = samples.cbegin(); it != samples.cend(); ++it)
+            {
+                if (!assertNear(rbfPreconditioned.eval(it->getX()), it->getY(), 1e-5, 1e-5))
+                {
+                    cout << "Test failed - the preconditioned RBF does not interpolate the samples" << endl;
+                    return;
+                }
+            }
+
+            // Blocked batch evaluation (more points than one block). The expanded squared distances
+            // lose some digits, which the large weights of the Gaussian kernel (about 1e9 here) amplify.
+            DenseMatrix points(2, 150);
+            for (unsigned int k = 0; k < 150; k++)
+            {
+                points(0,k) = -1 + 2*random();
+                points(1,k) = 2*random();
+            }
+
+            DenseVector y;
+            rbf.evalBatch(points, y, PointLayout::COLUMNS, 2);
+
+            for (unsigned int k = 0; k < 150; k++)
+            {
+                x = points.col(k);
+                if (!assertNear(y(k), rbf.eval(x), 1e-6, 1e-6))
+                {
+                    cout << "Test failed - batch evaluation differs from eval" << endl;
+                    return;
+                }
+            }
+        }
+    }
+
+    // r^2 log(r) is zero at r = 0 and r = 1, so samples a distance of 1 apart give a singular thin-plate matrix.
+    // These samples can still be interpolated, which the LU factorization alone fails to do.
+    DataTable singularSamples;
+    DenseVector x1(1);
+    for (unsigned int k = 0; k < 3; k++)
+    {
+        x1(0) = k;
+        singularSamples.addSample(x1, k - 1.0);
+    }
+
+    RadialBasisFunction tps(singularSamples, RadialBasisFunctionType::THIN_PLATE_SPLINE);
+
+    for (auto it = singularSamples.cbegin(); it != singularSamples.cend(); ++it)
+    {
+        if (!assertNear(tps.eval(it->getX()), it->getY(), 1e-10, 1e-10))
+        {
+            cout << "Test failed - the RBF does not interpolate the samples of a singular system" << endl;
+            return;
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * Compares the k-d tree queries to brute force search, in a point set with duplicates
+ */
+void testKdTree()
+{
+    cout << endl << endl;
+    cout << "Testing k-d tree..." << endl;
+
+    unsigned int seed = 4321;
+    auto random = [&seed]()
+    {
+        seed = 1103515245*seed + 12345;
+        return ((seed >> 8) % 100000)/100000.0;
+    };
+
+    const unsigned int numPoints = 500;
+    DenseMatrix points(numPoints, 3);
+    for (unsigned int i = 0; i < numPoints; i++)
+    {
+        for (unsigned int j = 0; j < 3; j++)
+            points(i,j) = random();
+    }
+    points.row(7) = points.row(3);
+
+    KdTree tree(points);
+    DenseVector x(3);
+
+    for (unsigned int q = 0; q < 50; q++)
+    {
+        for (unsigned int j = 0; j < 3; j++)
+            x(j) = -0.1 + 1.2*random();
+        if (q == 0)
+            x = points.row(3).transpose();
+
+        std::vector< std::pair<double, unsigned int> > distances;
+        for (unsigned int i = 0; i < numPoints; i++)
+            distances.push_back(std::make_pair((points.row(i).transpose() - x).squaredNorm(), i));
+        std::sort(distances.begin(), distances.end());
+
+        for (unsigned int k : {1, 5, 20, 600})
+        {
+            std::vector<unsigned int> nearest = tree.nearest(x, k);
+
+            if (nearest.size() != std::min(k, numPoints))
+            {
+                cout << "Test failed - wrong number of nearest neighbours" << endl;
+                return;
+            }
+
+            for (unsigned int i = 0; i < nearest.size(); i++)
+            {
+                if (nearest.at(i) != distances.at(i).second)
+                {
+                    cout << "Test failed - nearest neighbours differ from brute force search" << endl;
+                    return;
+                }
+            }
+        }
+
+        double radius = 0.2;
+        std::vector<unsigned int> expected;
+        for (auto &d : distances)
+        {
+            if (d.first <= radius*radius)
+                expected.push_back(d.second);
+        }
+        std::sort(expected.begin(), expected.end());
+
+        if (tree.withinRadius(x, radius) != expected)
+        {
+            cout << "Test failed - radius query differs from brute force search" << endl;
+            return;
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
 void testSplineDerivative()
 {
     cout << endl << endl;
-    cout << "Testing spline derivative..." << endl;
+    cout << "Testing spline derivative..." << endl;
+
+    // Create new DataTable to manage samples
+    DataTable samples;
+
+    // Sample function
+    double x0_lb = 0;
+    double x0_ub = 2;
+    double x1_lb = 0;
+    double x1_ub = 2;
+
+    auto x0_vec = linspace(x0_lb, x0_ub, 20);
+    auto x1_vec = linspace(x1_lb, x1_ub, 20);
+    DenseVector x(2);
+    double y;
+
+    for (auto x0 : x0_vec)
+    {
+        for (auto x1 : x1_vec)
+        {
+            // Sample function at x
+            x(0) = x0;
+            x(1) = x1;
+            y = sixHumpCamelBack(x);
+
+            // Store sample
+            samples.addSample(x,y);
+        }
+    }
+
+    // Build spline that interpolate the samples
+//    BSpline spline(samples, BSplineType::LINEAR);
+//    BSpline spline(samples, BSplineType::QUADRATIC);
+    BSpline spline(samples, BSplineType::CUBIC);
+//    RBFSpline spline(samples, RadialBasisFunctionType::THIN_PLATE_SPLINE);
+//    RBFSpline spline(samples, RadialBasisFunctionType::MULTIQUADRIC);
+
+    auto x0_vec_2 = linspace(x0_lb, x0_ub, 200);
+    auto x1_vec_2 = linspace(x1_lb, x1_ub, 200);
+
+    double tol = 1e-4;  // Absolute error tolerance
+    double h = 1e-8;    // Finite difference step length
+    double x0_diff, x1_diff;
+
+    for (auto x0 : x0_vec_2)
+    {
+        for (auto x1 : x1_vec_2)
+        {
+            x(0) = x0;
+            x(1) = x1;
+
+            DenseMatrix dfdx = spline.evalJacobian(x);
+            if (dfdx.cols() != 2)
+            {
+                cout << "Test failed - check Jacobian size!" << endl;
+                return;
+            }
+
+            // Finite difference in x0
+            if (x(0) == x0_ub)
+            {
+                // Backward diff
+                DenseVector dx1f = x;
+                DenseVector dx1b = x; dx1b(0) = x(0)-h;
+                x0_diff = (spline.eval(dx1f) - spline.eval(dx1b))/h;
+            }
+            else if (x(0) == x0_lb)
+            {
+                // Forward diff
+                DenseVector dx1f = x; dx1f(0) = x(0)+h;
+                DenseVector dx1b = x;
+                x0_diff = (spline.eval(dx1f) - spline.eval(dx1b))/h;
+            }
+            else
+            {
+                // Central diff
+                DenseVector dx1f = x; dx1f(0) = x(0)+h/2;
+                DenseVector dx1b = x; dx1b(0) = x(0)-h/2;
+                x0_diff = (spline.eval(dx1f) - spline.eval(dx1b))/h;
+            }
+
+            // Finite difference in x1
+            if (x(1) == x1_ub)
+            {
+                // Backward diff
+                DenseVector dx2f = x;
+                DenseVector dx2b = x; dx2b(1) = x(1)-h;
+                x1_diff = (spline.eval(dx2f) - spline.eval(dx2b))/h;
+            }
+            else if (x(1) == x1_lb)
+            {
+                // Forward diff
+                DenseVector dx2f = x; dx2f(1) = x(1)+h;
+                DenseVector dx2b = x;
+                x1_diff = (spline.eval(dx2f) - spline.eval(dx2b))/h;
+            }
+            else
+            {
+                // Central diff
+                DenseVector dx2f = x; dx2f(1) = x(1)+h/2;
+                DenseVector dx2b = x; dx2b(1) = x(1)-h/2;
+                x1_diff = (spline.eval(dx2f) - spline.eval(dx2b))/h;
+            }
+
+            if (std::abs(dfdx(0) - x0_diff) > tol
+                || std::abs(dfdx(1) - x1_diff) > tol)
+            {
+                cout << x0 << ", " << x1 << endl;
+                cout << dfdx(0) - x0_diff << endl;
+                cout << dfdx(1) - x1_diff << endl;
+                cout << "Test failed - check Jacobian!" << endl;
+                return;
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+double polynomialTestFunction(DenseVector x)
+{
+    return 1 + x(0) - 2*x(1)*x(1) + x(0)*x(1)*x(2) + 0.5*x(2)*x(2)*x(2);
+}
+
+/*
+ * A cubic B-spline reproduces a cubic polynomial exactly,
+ * which checks the indexing of the coefficients in three variables.
+ * The Jacobian and Hessian are compared to the exact derivatives.
+ */
+void testPolynomialReproduction()
+{
+    cout << endl << endl;
+    cout << "Testing polynomial reproduction..." << endl;
+
+    DataTable samples;
+    DenseVector x(3);
+
+    auto x0_vec = linspace(-1, 1, 7);
+    auto x1_vec = linspace(0, 2, 8);
+    auto x2_vec = linspace(-2, 1, 9);
+
+    for (auto x0 : x0_vec)
+    {
+        for (auto x1 : x1_vec)
+        {
+            for (auto x2 : x2_vec)
+            {
+                x(0) = x0;
+                x(1) = x1;
+                x(2) = x2;
+                samples.addSample(x, polynomialTestFunction(x));
+            }
+        }
+    }
+
+    BSpline bspline(samples, BSplineType::CUBIC);
+
+    for (auto x0 : linspace(-1, 1, 13))
+    {
+        for (auto x1 : linspace(0, 2, 11))
+        {
+            for (auto x2 : linspace(-2, 1, 17))
+            {
+                x(0) = x0;
+                x(1) = x1;
+                x(2) = x2;
+
+                if (std::abs(bspline.eval(x) - polynomialTestFunction(x)) > 1e-8)
+                {
+                    cout << "Test failed - check evaluation at " << x.transpose() << endl;
+                    return;
+                }
+
+                DenseMatrix jacobian = bspline.evalJacobian(x);
+                DenseMatrix exact(1,3);
+                exact << 1 + x(1)*x(2), -4*x(1) + x(0)*x(2), x(0)*x(1) + 1.5*x(2)*x(2);
+
+                if ((jacobian - exact).cwiseAbs().maxCoeff() > 1e-7)
+                {
+                    cout << "Test failed - check Jacobian at " << x.transpose() << endl;
+                    return;
+                }
+
+                DenseMatrix hessian = bspline.evalHessian(x);
+                DenseMatrix exactHessian(3,3);
+                exactHessian << 0,    x(2), x(1),
+                                x(2), -4,   x(0),
+                                x(1), x(0), 3*x(2);
+
+                if ((hessian - exactHessian).cwiseAbs().maxCoeff() > 1e-6)
+                {
+                    cout << "Test failed - check Hessian at " << x.transpose() << endl;
+                    return;
+                }
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * On a complete grid, the control points are computed one variable at a time.
+ * The B-spline must interpolate the samples, also on larger grids with uneven spacing.
+ */
+void testGridInterpolation()
+{
+    cout << endl << endl;
+    cout << "Testing grid interpolation..." << endl;
+
+    DataTable samples;
+    DenseVector x(3);
+
+    auto x0_vec = linspace(-1, 1, 40);
+    auto x1_vec = linspace(0, 2, 50);
+    auto x2_vec = linspace(-2, 1, 30);
+
+    // Uneven spacing in the second variable
+    for (auto &x1 : x1_vec)
+        x1 = x1*x1/2;
+
+    for (auto x0 : x0_vec)
+    {
+        for (auto x1 : x1_vec)
+        {
+            for (auto x2 : x2_vec)
+            {
+                x(0) = x0;
+                x(1) = x1;
+                x(2) = x2;
+                samples.addSample(x, polynomialTestFunction(x) + std::sin(5*x0*x1));
+            }
+        }
+    }
+
+    for (auto type : {BSplineType::LINEAR, BSplineType::QUADRATIC, BSplineType::CUBIC})
+    {
+        BSpline bspline(samples, type);
+
+        for (auto it = samples.cbegin(); it != samples.cend(); ++it)
+        {
+            std::vector<double> xv = it->getX();
+            DenseVector xi = Eigen::Map<DenseVector>(xv.data(), xv.size());
+            if (std::abs(bspline.eval(xi) - it->getY()) > 1e-8)
+            {
+                cout << "Test failed - B-spline does not interpolate the sample at " << xi.transpose() << endl;
+                return;
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * The P-spline control points are computed with univariate matrices on complete grids.
+ * They must agree with the solution of the normal equations (B'*B + l*D'*D)*c = B'*y,
+ * here formed explicitly with dense matrices.
+ */
+void testPSplineKronecker()
+{
+    cout << endl << endl;
+    cout << "Testing P-spline on grid..." << endl;
+
+    DataTable samples;
+    DenseVector x(2);
+
+    auto x0_vec = linspace(-1, 1, 7);
+    auto x1_vec = linspace(0, 2, 9);
+
+    // Uneven spacing in the second variable
+    for (auto &x1 : x1_vec)
+        x1 = x1*x1/2;
+
+    for (auto x0 : x0_vec)
+    {
+        for (auto x1 : x1_vec)
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, sixHumpCamelBack(x));
+        }
+    }
+
+    double lambda = 0.5;
+    PSpline pspline(samples, lambda);
+
+    std::vector< std::vector<double> > knots = pspline.getKnotVectors();
+    std::vector<unsigned int> degrees = pspline.getBasisDegrees();
+    std::vector<unsigned int> n = pspline.getNumBasisFunctions();
+    unsigned int numBasisFunctions = n.at(0)*n.at(1);
+    unsigned int numSamples = samples.getNumSamples();
+
+    // Basis function matrix, evaluated column by column with unit coefficients
+    DenseMatrix B(numSamples, numBasisFunctions);
+    for (unsigned int k = 0; k < numBasisFunctions; k++)
+    {
+        std::vector<double> unit(numBasisFunctions, 0);
+        unit.at(k) = 1;
+        BSpline basisFunction(unit, knots, degrees);
+
+        unsigned int j = 0;
+        for (auto it = samples.cbegin(); it != samples.cend(); ++it, ++j)
+        {
+            std::vector<double> xv = it->getX();
+            B(j,k) = basisFunction.eval(Eigen::Map<DenseVector>(xv.data(), xv.size()));
+        }
+    }
+
+    // Second-order differences in each variable (the last variable runs fastest)
+    DenseMatrix P = DenseMatrix::Zero(numBasisFunctions, numBasisFunctions);
+    for (unsigned int k0 = 0; k0 < n.at(0); k0++)
+    {
+        for (unsigned int k1 = 0; k1 < n.at(1); k1++)
+        {
+            if (k0 + 2 < n.at(0))
+            {
+                DenseVector d = DenseVector::Zero(numBasisFunctions);
+                d(k0*n.at(1) + k1) = 1;
+                d((k0+1)*n.at(1) + k1) = -2;
+                d((k0+2)*n.at(1) + k1) = 1;
+                P += d*d.transpose();
+            }
+            if (k1 + 2 < n.at(1))
+            {
+                DenseVector d = DenseVector::Zero(numBasisFunctions);
+                d(k0*n.at(1) + k1) = 1;
+                d(k0*n.at(1) + k1 + 1) = -2;
+                d(k0*n.at(1) + k1 + 2) = 1;
+                P += d*d.transpose();
+            }
+        }
+    }
+
+    DenseMatrix R(numSamples, 3);
+    unsigned int j = 0;
+    for (auto it = samples.cbegin(); it != samples.cend(); ++it, ++j)
+        R.row(j) << it->getX().at(0), it->getX().at(1), it->getY();
+
+    DenseMatrix L = B.transpose()*B + lambda*P;
+    DenseMatrix C = L.colPivHouseholderQr().solve(B.transpose()*R);
+
+    DenseMatrix controlPoints = pspline.getControlPoints();
+
+    if ((controlPoints - C.transpose()).cwiseAbs().maxCoeff() > 1e-8)
+    {
+        cout << "Test failed - P-spline control points differ from the normal equations" << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * The smoothing parameter selected by generalized cross-validation must give a smaller
+ * error (with respect to the noise-free function) than almost no smoothing or heavy smoothing.
+ * On a small grid, it must minimize the exact GCV score.
+ */
+void testPSplineGCV()
+{
+    cout << endl << endl;
+    cout << "Testing P-spline smoothing parameter selection..." << endl;
+
+    DataTable samples;
+    DenseVector x(2);
+
+    // Pseudo-random noise (linear congruential generator)
+    unsigned int seed = 12345;
+    auto noise = [&seed]()
+    {
+        seed = 1103515245*seed + 12345;
+        return ((seed >> 8) % 10000)/10000.0 - 0.5;
+    };
+
+    for (auto x0 : linspace(-1, 1, 30))
+    {
+        for (auto x1 : linspace(-1, 1, 25))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, sixHumpCamelBack(x) + 0.2*noise());
+        }
+    }
+
+    PSpline selected(samples, SmoothingParameterSelection::GCV);
+    PSpline rough(samples, 1e-8);
+    PSpline smooth(samples, 1e4);
+
+    auto error = [&](const PSpline &pspline)
+    {
+        double sum = 0;
+        for (auto it = samples.cbegin(); it != samples.cend(); ++it)
+        {
+            std::vector<double> xv = it->getX();
+            DenseVector xi = Eigen::Map<DenseVector>(xv.data(), xv.size());
+            sum += std::pow(pspline.eval(xi) - sixHumpCamelBack(xi), 2);
+        }
+        return sum;
+    };
+
+    double lambda = selected.getLambda();
+    if (!(lambda > 1e-8 && lambda < 1e4) || error(selected) >= error(rough) || error(selected) >= error(smooth))
+    {
+        cout << "Test failed - poor smoothing parameter " << lambda << endl;
+        return;
+    }
+
+    // On a small grid, the selected value must minimize the exact GCV score of the fitted penalty
+    // l*(P_1 x I + I x P_2), computed here with dense matrices on a fine grid of values
+    DataTable smallSamples;
+    for (auto x0 : linspace(-1, 1, 9))
+    {
+        for (auto x1 : linspace(-1, 1, 8))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            smallSamples.addSample(x, sixHumpCamelBack(x) + 0.2*noise());
+        }
+    }
+
+    PSpline smallSelected(smallSamples, SmoothingParameterSelection::GCV);
+
+    std::vector< std::vector<double> > knots = smallSelected.getKnotVectors();
+    std::vector<unsigned int> degrees = smallSelected.getBasisDegrees();
+    std::vector<unsigned int> n = smallSelected.getNumBasisFunctions();
+    unsigned int numBasisFunctions = n.at(0)*n.at(1);
+    unsigned int numSamples = smallSamples.getNumSamples();
+
+    DenseMatrix B(numSamples, numBasisFunctions);
+    DenseVector y(numSamples);
+    for (unsigned int k = 0; k < numBasisFunctions; k++)
+    {
+        std::vector<double> unit(numBasisFunctions, 0);
+        unit.at(k) = 1;
+        BSpline basisFunction(unit, knots, degrees);
+
+        unsigned int j = 0;
+        for (auto it = smallSamples.cbegin(); it != smallSamples.cend(); ++it, ++j)
+        {
+            std::vector<double> xv = it->getX();
+            B(j,k) = basisFunction.eval(Eigen::Map<DenseVector>(xv.data(), xv.size()));
+            y(j) = it->getY();
+        }
+    }
+
+    DenseMatrix P = DenseMatrix::Zero(numBasisFunctions, numBasisFunctions);
+    for (unsigned int k0 = 0; k0 < n.at(0); k0++)
+    {
+        for (unsigned int k1 = 0; k1 < n.at(1); k1++)
+        {
+            if (k0 + 2 < n.at(0))
+            {
+                DenseVector d = DenseVector::Zero(numBasisFunctions);
+                d(k0*n.at(1) + k1) = 1;
+                d((k0+1)*n.at(1) + k1) = -2;
+                d((k0+2)*n.at(1) + k1) = 1;
+                P += d*d.transpose();
+            }
+            if (k1 + 2 < n.at(1))
+            {
+                DenseVector d = DenseVector::Zero(numBasisFunctions);
+                d(k0*n.at(1) + k1) = 1;
+                d(k0*n.at(1) + k1 + 1) = -2;
+                d(k0*n.at(1) + k1 + 2) = 1;
+                P += d*d.transpose();
+            }
+        }
+    }
+
+    auto exactGCV = [&](double l)
+    {
+        DenseMatrix H = B*(B.transpose()*B + l*P).ldlt().solve(B.transpose());
+        double dof = numSamples - H.trace();
+        return numSamples*(y - H*y).squaredNorm()/(dof*dof);
+    };
+
+    double minLogLambda = -8;
+    double minScore = exactGCV(1e-8);
+    for (unsigned int k = 1; k <= 1200; k++)
+    {
+        double logLambda = -8 + k*0.01;
+        double score = exactGCV(std::pow(10.0, logLambda));
+        if (score < minScore)
+        {
+            minScore = score;
+            minLogLambda = logLambda;
+        }
+    }
+
+    if (std::abs(std::log10(smallSelected.getLambda()) - minLogLambda) > 0.05 || exactGCV(smallSelected.getLambda()) > (1 + 1e-6)*minScore)
+    {
+        cout << "Test failed - smoothing parameter " << smallSelected.getLambda() << " does not minimize the exact GCV score (minimizer "
+             << std::pow(10.0, minLogLambda) << ")" << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * Refitting on a fixed grid must give the same splines as constructing them from the new samples
+ */
+void testFitter()
+{
+    cout << endl << endl;
+    cout << "Testing refitting on a fixed grid..." << endl;
+
+    DataTable samples, newSamples;
+    DenseVector x(2);
+
+    for (auto x0 : linspace(-1, 1, 11))
+    {
+        for (auto x1 : linspace(0, 2, 13))
+        {
+            x(0) = x0;
+            x(1) = x1*x1/2;
+            samples.addSample(x, sixHumpCamelBack(x));
+            newSamples.addSample(x, std::cos(x0 + 2*x1));
+        }
+    }
+
+    BSplineFitter bsplineFitter(samples, BSplineType::CUBIC);
+    PSplineFitter psplineFitter(samples, 0.1);
+
+    BSpline bspline = bsplineFitter.refit(newSamples.getVectorY());
+    BSpline bsplineReference(newSamples, BSplineType::CUBIC);
+    PSpline pspline = psplineFitter.refit(newSamples.getVectorY());
+    PSpline psplineReference(newSamples, 0.1);
+
+    // Warm start from the solution
+    PSpline psplineWarm = psplineFitter.refit(newSamples.getVectorY(), pspline);
+
+    for (auto x0 : linspace(-1, 1, 23))
+    {
+        for (auto x1 : linspace(0, 2, 19))
+        {
+            x(0) = x0;
+            x(1) = x1;
+
+            if (std::abs(bspline.eval(x) - bsplineReference.eval(x)) > 1e-10
+                || std::abs(pspline.eval(x) - psplineReference.eval(x)) > 1e-8
+                || std::abs(psplineWarm.eval(x) - psplineReference.eval(x)) > 1e-8)
+            {
+                cout << "Test failed - refitted spline differs at " << x.transpose() << endl;
+                return;
+            }
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * A P-spline fitted to scattered, weighted samples must solve the normal equations
+ * (B'*W*B + l*D'*D)*c = B'*W*y, here formed explicitly with dense matrices,
+ * for any number of threads.
+ */
+void testPSplineScattered()
+{
+    cout << endl << endl;
+    cout << "Testing P-spline on scattered samples..." << endl;
+
+    // Pseudo-random points (linear congruential generator)
+    unsigned int seed = 54321;
+    auto random = [&seed]()
+    {
+        seed = 1103515245*seed + 12345;
+        return ((seed >> 8) % 10000)/10000.0;
+    };
+
+    DataTable samples;
+    std::vector<double> weights;
+    DenseVector x(2);
+
+    for (unsigned int k = 0; k < 300; k++)
+    {
+        x(0) = -1 + 2*random();
+        x(1) = 2*random();
+        samples.addSample(x, sixHumpCamelBack(x));
+        weights.push_back(0.5 + random());
+    }
+
+    std::vector< std::vector<double> > knots = {{-1, -1, -1, -1, -0.5, 0, 0.3, 1, 1, 1, 1},
+                                                {0, 0, 0, 0.5, 1, 1.5, 2, 2, 2}};
+    std::vector<unsigned int> degrees = {3, 2};
+    double lambda = 0.01;
+
+    PSpline pspline(samples, knots, degrees, lambda, weights, 1);
+    PSpline psplineThreaded(samples, knots, degrees, lambda, weights, 4);
+
+    std::vector<unsigned int> n = pspline.getNumBasisFunctions();
+    unsigned int numBasisFunctions = n.at(0)*n.at(1);
+    unsigned int numSamples = samples.getNumSamples();
+
+    // Weighted basis function matrix, evaluated column by column with unit coefficients
+    DenseMatrix B(numSamples, numBasisFunctions);
+    DenseVector y(numSamples), w = Eigen::Map<DenseVector>(weights.data(), weights.size());
+    for (unsigned int k = 0; k < numBasisFunctions; k++)
+    {
+        std::vector<double> unit(numBasisFunctions, 0);
+        unit.at(k) = 1;
+        BSpline basisFunction(unit, knots, degrees);
+
+        unsigned int j = 0;
+        for (auto it = samples.cbegin(); it != samples.cend(); ++it, ++j)
+        {
+            std::vector<double> xv = it->getX();
+            B(j,k) = basisFunction.eval(Eigen::Map<DenseVector>(xv.data(), xv.size()));
+            y(j) = it->getY();
+        }
+    }
+
+    DenseMatrix P = DenseMatrix::Zero(numBasisFunctions, numBasisFunctions);
+    for (unsigned int k0 = 0; k0 < n.at(0); k0++)
+    {
+        for (unsigned int k1 = 0; k1 < n.at(1); k1++)
+        {
+            if (k0 + 2 < n.at(0))
+            {
+                DenseVector d = DenseVector::Zero(numBasisFunctions);
+                d(k0*n.at(1) + k1) = 1;
+                d((k0+1)*n.at(1) + k1) = -2;
+                d((k0+2)*n.at(1) + k1) = 1;
+                P += d*d.transpose();
+            }
+            if (k1 + 2 < n.at(1))
+            {
+                DenseVector d = DenseVector::Zero(numBasisFunctions);
+                d(k0*n.at(1) + k1) = 1;
+                d(k0*n.at(1) + k1 + 1) = -2;
+                d(k0*n.at(1) + k1 + 2) = 1;
+                P += d*d.transpose();
+            }
+        }
+    }
+
+    DenseMatrix L = B.transpose()*w.asDiagonal()*B + lambda*P;
+    DenseVector c = L.ldlt().solve(B.transpose()*w.asDiagonal()*y);
+
+    DenseMatrix C = pspline.getControlPoints().bottomRows(1).transpose();
+    DenseMatrix CThreaded = psplineThreaded.getControlPoints().bottomRows(1).transpose();
+
+    if ((C - c).cwiseAbs().maxCoeff() > 1e-8 || (CThreaded - c).cwiseAbs().maxCoeff() > 1e-8)
+    {
+        cout << "Test failed - P-spline control points differ from the normal equations" << endl;
+        return;
+    }
+
+    // One weight per sample, none of them negative
+    std::vector< std::vector<double> > invalidWeights = {std::vector<double>(weights.size() - 1, 1.0), weights};
+    invalidWeights.back().at(0) = -1;
+
+    for (auto &invalid : invalidWeights)
+    {
+        try
+        {
+            PSpline psplineInvalid(samples, knots, degrees, lambda, invalid);
+            cout << "Test failed - no exception for invalid weights!" << endl;
+            return;
+        }
+        catch (Exception &e)
+        {
+        }
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * Multilevel B-spline approximation of scattered samples must approximate the function
+ * better as levels are added.
+ */
+void testMultilevelApproximation()
+{
+    cout << endl << endl;
+    cout << "Testing multilevel B-spline approximation..." << endl;
+
+    // Pseudo-random points (linear congruential generator)
+    unsigned int seed = 2468;
+    auto random = [&seed]()
+    {
+        seed = 1103515245*seed + 12345;
+        return ((seed >> 8) % 100000)/100000.0;
+    };
+
+    DataTable samples;
+    DenseVector x(2);
+
+    for (unsigned int k = 0; k < 5000; k++)
+    {
+        x(0) = -1 + 2*random();
+        x(1) = 2*random();
+        samples.addSample(x, sixHumpCamelBack(x));
+    }
+
+    double previousError = 1e100;
+    for (unsigned int numLevels : {1, 3, 5})
+    {
+        BSpline bspline = BSpline::multilevelApproximation(samples, 3, numLevels);
+
+        double error = 0;
+        for (auto x0 : linspace(-0.95, 0.95, 21))
+        {
+            for (auto x1 : linspace(0.05, 1.95, 21))
+            {
+                x(0) = x0;
+                x(1) = x1;
+                error = std::max(error, std::abs(bspline.eval(x) - sixHumpCamelBack(x)));
+            }
+        }
+
+        if (error >= previousError)
+        {
+            cout << "Test failed - the error does not decrease with the number of levels" << endl;
+            return;
+        }
+        previousError = error;
+    }
+
+    if (previousError > 0.05)
+    {
+        cout << "Test failed - poor approximation " << previousError << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * Knot insertion, refinement, Bezier decomposition and domain reduction are applied to the
+ * control points one variable at a time. The B-spline must be unchanged on the (reduced) domain.
+ */
+void testKnotRefinement()
+{
+    cout << endl << endl;
+    cout << "Testing knot refinement..." << endl;
 
-    // Create new DataTable to manage samples
-    DataTable samples;
+    // Pseudo-random coefficients and points (linear congruential generator)
+    unsigned int seed = 1357;
+    auto random = [&seed]()
+    {
+        seed = 1103515245*seed + 12345;
+        return ((seed >> 8) % 100000)/100000.0;
+    };
 
-    // Sample function
-    double x0_lb = 0;
-    double x0_ub = 2;
-    double x1_lb = 0;
-    double x1_ub = 2;
+    unsigned int numVariables = 4;
+    std::vector<unsigned int> degrees = {3, 2, 3, 1};
+    std::vector< std::vector<double> > knotVectors;
+    unsigned int numCoefficients = 1;
 
-    auto x0_vec = linspace(x0_lb, x0_ub, 20);
-    auto x1_vec = linspace(x1_lb, x1_ub, 20);
-    DenseVector x(2);
-    double y;
+    for (unsigned int i = 0; i < numVariables; i++)
+    {
+        std::vector<double> knots(degrees.at(i) + 1, 0);
+        for (auto t : {0.2, 0.5, 0.6, 0.9})
+            knots.push_back(t);
+        knots.insert(knots.end(), degrees.at(i) + 1, 1);
 
-    for (auto x0 : x0_vec)
+        knotVectors.push_back(knots);
+        numCoefficients *= knots.size() - degrees.at(i) - 1;
+    }
+
+    DenseMatrix coefficients(1, numCoefficients);
+    for (unsigned int k = 0; k < numCoefficients; k++)
+        coefficients(0,k) = random();
+
+    BSpline original(coefficients, knotVectors, degrees);
+
+    std::vector<DenseVector> points;
+    for (unsigned int k = 0; k < 200; k++)
     {
-        for (auto x1 : x1_vec)
+        DenseVector x(numVariables);
+        for (unsigned int i = 0; i < numVariables; i++)
+            x(i) = 0.3 + 0.4*random();
+        points.push_back(x);
+    }
+
+    auto maxError = [&](const BSpline &bspline)
+    {
+        double error = 0;
+        for (auto &x : points)
+            error = std::max(error, std::abs(bspline.eval(x) - original.eval(x)));
+        return error;
+    };
+
+    BSpline inserted(original);
+    inserted.insertKnots(0.35, 2, 2);
+
+    BSpline refined(original);
+    refined.globalKnotRefinement();
+
+    BSpline locallyRefined(original);
+    locallyRefined.localKnotRefinement(points.front());
+
+    BSpline bezier(original);
+    bezier.decomposeToBezierForm();
+
+    BSpline reduced(original);
+    reduced.reduceDomain({0.25, 0.2, 0.3, 0.1}, {0.75, 0.8, 0.7, 0.95});
+
+    if (inserted.getNumControlPoints() != numCoefficients/8*10)
+    {
+        cout << "Test failed - wrong number of control points after knot insertion" << endl;
+        return;
+    }
+
+    if (reduced.getNumControlPoints() >= numCoefficients)
+    {
+        cout << "Test failed - no control points removed by domain reduction" << endl;
+        return;
+    }
+
+    for (auto bspline : {&inserted, &refined, &locallyRefined, &bezier, &reduced})
+    {
+        double error = maxError(*bspline);
+        if (error > 1e-12)
         {
-            // Sample function at x
-            x(0) = x0;
-            x(1) = x1;
-            y = sixHumpCamelBack(x);
+            cout << "Test failed - the B-spline changed " << error << endl;
+            return;
+        }
 
-            // Store sample
-            samples.addSample(x,y);
+        // The knot averages must follow the coefficients (linear precision)
+        DenseMatrix controlPoints = bspline->getControlPoints();
+        for (unsigned int i = 0; i < numVariables; i++)
+        {
+            BSpline linear(controlPoints.row(i), bspline->getKnotVectors(), bspline->getBasisDegrees());
+            for (auto &x : points)
+            {
+                if (std::abs(linear.eval(x) - x(i)) > 1e-12)
+                {
+                    cout << "Test failed - inconsistent knot averages" << endl;
+                    return;
+                }
+            }
         }
     }
 
-    // Build spline that interpolate the samples
-//    BSpline spline(samples, BSplineType::LINEAR);
-//    BSpline spline(samples, BSplineType::QUADRATIC);
-    BSpline spline(samples, BSplineType::CUBIC);
-//    RBFSpline spline(samples, RadialBasisFunctionType::THIN_PLATE_SPLINE);
-//    RBFSpline spline(samples, RadialBasisFunctionType::MULTIQUADRIC);
+    cout << "Test finished successfully!" << endl;
+}
 
-    auto x0_vec_2 = linspace(x0_lb, x0_ub, 200);
-    auto x1_vec_2 = linspace(x1_lb, x1_ub, 200);
+/*
+ * The matrix-free conjugate gradient method must solve a Kronecker product system applied
+ * one mode at a time, and converge immediately when started from the solution.
+ */
+void testConjugateGradient()
+{
+    cout << endl << endl;
+    cout << "Testing matrix-free conjugate gradient method..." << endl;
 
-    double tol = 1e-4;  // Absolute error tolerance
-    double h = 1e-8;    // Finite difference step length
-    double x0_diff, x1_diff;
+    std::vector<unsigned int> dims = {7, 5, 6};
+    std::vector<DenseMatrix> factors;
+    for (auto n : dims)
+    {
+        DenseMatrix A = DenseMatrix::Zero(n, n);
+        for (unsigned int j = 0; j < n; j++)
+        {
+            A(j,j) = 3 + std::sin(j);
+            if (j + 1 < n)
+                A(j,j+1) = A(j+1,j) = -1;
+        }
+        factors.push_back(A);
+    }
 
-    for (auto x0 : x0_vec_2)
+    auto applyA = [&](DenseVector x)
     {
-        for (auto x1 : x1_vec_2)
+        std::vector<unsigned int> d = dims;
+        for (unsigned int i = 0; i < dims.size(); i++)
+            tensorModeProduct(factors.at(i), d, i, x);
+        return x;
+    };
+
+    // Jacobi preconditioner (the diagonal of a Kronecker product is the Kronecker product of the diagonals)
+    auto applyPreconditioner = [&](DenseVector r)
+    {
+        std::vector<unsigned int> d = dims;
+        for (unsigned int i = 0; i < dims.size(); i++)
+            tensorModeProduct(DenseMatrix(factors.at(i).diagonal().cwiseInverse().asDiagonal()), d, i, r);
+        return r;
+    };
+
+    DenseMatrix A = Eigen::kroneckerProduct(factors.at(0), Eigen::kroneckerProduct(factors.at(1), factors.at(2)).eval()).eval();
+    DenseVector b(A.rows());
+    for (unsigned int j = 0; j < b.size(); j++)
+        b(j) = std::cos(j);
+
+    ConjugateGradient solver;
+    DenseVector x;
+    bool converged = solver.solve(applyA, applyPreconditioner, b, x);
+
+    if (!converged || (x - A.ldlt().solve(b)).cwiseAbs().maxCoeff() > 1e-10)
+    {
+        cout << "Test failed - wrong solution" << endl;
+        return;
+    }
+
+    if (!solver.solve(applyA, applyPreconditioner, b, x) || solver.getNumIterations() > 1)
+    {
+        cout << "Test failed - warm start from the solution did not converge immediately" << endl;
+        return;
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * Batch evaluation must agree with point-wise evaluation for both point layouts
+ * and for any number of threads. The RBF evaluates blocks of points by matrix products,
+ * and the B-splines of degree 1 to 4 use the vectorized kernel (both may differ from
+ * point-wise evaluation by rounding, the B-splines when fused multiply-add is available).
+ */
+void testBatchEvaluation()
+{
+    cout << endl << endl;
+    cout << "Testing batch evaluation..." << endl;
+
+    DataTable samples;
+    DenseVector x(2);
+
+    for (auto x0 : linspace(-1, 1, 10))
+    {
+        for (auto x1 : linspace(0, 2, 12))
         {
             x(0) = x0;
             x(1) = x1;
+            samples.addSample(x, sixHumpCamelBack(x));
+        }
+    }
 
-            DenseMatrix dfdx = spline.evalJacobian(x);
-            if (dfdx.cols() != 2)
+    BSpline linear(samples, BSplineType::LINEAR);
+    BSpline quadratic(samples, BSplineType::QUADRATIC);
+    BSpline bspline(samples, BSplineType::CUBIC);
+
+    // Free knot vectors are not available for quartic splines, so the knots are given explicitly
+    std::vector<double> quarticCoefficients;
+    for (unsigned int i = 0; i < 8*6; i++)
+        quarticCoefficients.push_back(std::sin(i));
+    std::vector< std::vector<double> > quarticKnots = {{-1, -1, -1, -1, -1, -0.5, 0, 0.5, 1, 1, 1, 1, 1},
+                                                       {0, 0, 0, 0, 0, 1, 2, 2, 2, 2, 2}};
+    BSpline quartic(quarticCoefficients, quarticKnots, {4, 4});
+    RadialBasisFunction rbf(samples, RadialBasisFunctionType::THIN_PLATE_SPLINE);
+
+    // One point per column
+    unsigned int numPoints = 1001;
+    DenseMatrix points(2, numPoints);
+    for (unsigned int i = 0; i < numPoints; i++)
+    {
+        points(0,i) = -1 + 2.0*i/(numPoints - 1);
+        points(1,i) = 2.0*((7*i) % numPoints)/(numPoints - 1);
+    }
+
+    std::vector<Approximant*> approximants = {&linear, &quadratic, &bspline, &quartic, &rbf};
+
+    for (auto approximant : approximants)
+    {
+        DenseVector y, yRows;
+        approximant->evalBatch(points, y);
+        approximant->evalBatch(points.transpose(), yRows, PointLayout::ROWS, 4);
+
+        if (y.size() != numPoints || yRows.size() != numPoints)
+        {
+            cout << "Test failed - wrong size of batch output!" << endl;
+            return;
+        }
+
+        for (unsigned int i = 0; i < numPoints; i++)
+        {
+            x = points.col(i);
+            if (!assertNear(y(i), approximant->eval(x), 1e-12, 1e-12) || yRows(i) != y(i))
             {
-                cout << "Test failed - check Jacobian size!" << endl;
+                cout << "Test failed - batch evaluation differs at " << x.transpose() << endl;
                 return;
             }
+        }
+    }
 
-            // Finite difference in x0
-            if (x(0) == x0_ub)
-            {
-                // Backward diff
-                DenseVector dx1f = x;
-                DenseVector dx1b = x; dx1b(0) = x(0)-h;
-                x0_diff = (spline.eval(dx1f) - spline.eval(dx1b))/h;
-            }
-            else if (x(0) == x0_lb)
-            {
-                // Forward diff
-                DenseVector dx1f = x; dx1f(0) = x(0)+h;
-                DenseVector dx1b = x;
-                x0_diff = (spline.eval(dx1f) - spline.eval(dx1b))/h;
-            }
-            else
-            {
-                // Central diff
-                DenseVector dx1f = x; dx1f(0) = x(0)+h/2;
-                DenseVector dx1b = x; dx1b(0) = x(0)-h/2;
-                x0_diff = (spline.eval(dx1f) - spline.eval(dx1b))/h;
-            }
+    DenseMatrix jacobians, jacobiansRows;
+    bspline.evalJacobianBatch(points, jacobians, PointLayout::COLUMNS, 3);
+    bspline.evalJacobianBatch(points.transpose(), jacobiansRows, PointLayout::ROWS);
 
-            // Finite difference in x1
-            if (x(1) == x1_ub)
-            {
-                // Backward diff
-                DenseVector dx2f = x;
-                DenseVector dx2b = x; dx2b(1) = x(1)-h;
-                x1_diff = (spline.eval(dx2f) - spline.eval(dx2b))/h;
-            }
-            else if (x(1) == x1_lb)
+    for (unsigned int i = 0; i < numPoints; i++)
+    {
+        x = points.col(i);
+        DenseMatrix jacobian = bspline.evalJacobian(x);
+
+        if ((jacobians.row(i) - jacobian).cwiseAbs().maxCoeff() != 0
+            || (jacobiansRows.row(i) - jacobian).cwiseAbs().maxCoeff() != 0)
+        {
+            cout << "Test failed - batch Jacobian differs at " << x.transpose() << endl;
+            return;
+        }
+    }
+
+    // Points outside the domain are reported from any thread
+    points(0, numPoints - 1) = 2;
+    try
+    {
+        DenseVector y;
+        bspline.evalBatch(points, y, PointLayout::COLUMNS, 4);
+        cout << "Test failed - no exception for point outside domain!" << endl;
+        return;
+    }
+    catch (Exception &e)
+    {
+    }
+
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * Basis functions on uniform knots are evaluated with the precomputed uniform basis
+ * matrices. They are compared with the general Cox-de Boor evaluation on a knot vector
+ * that is perturbed just enough to not be detected as uniform (the points avoid the knots).
+ */
+void testUniformKnots()
+{
+    cout << endl << endl;
+    cout << "Testing uniform knots..." << endl;
+
+    for (unsigned int degree = 1; degree <= MAX_UNIFORM_DEGREE; degree++)
+    {
+        std::vector<double> knots, perturbedKnots;
+        for (unsigned int i = 0; i < degree; i++)
+            knots.push_back(-1);
+        for (auto knot : linspace(-1, 2, 13))
+            knots.push_back(knot);
+        for (unsigned int i = 0; i < degree; i++)
+            knots.push_back(2);
+
+        for (unsigned int i = 0; i < knots.size(); i++)
+        {
+            bool interior = knots.at(i) > knots.front() && knots.at(i) < knots.back();
+            perturbedKnots.push_back(interior ? knots.at(i) + (i % 2 ? 1e-9 : -1e-9) : knots.at(i));
+        }
+
+        BSplineBasis1D uniform(knots, degree, KnotVectorType::EXPLICIT);
+        BSplineBasis1D general(perturbedKnots, degree, KnotVectorType::EXPLICIT);
+
+        if (!uniform.hasUniformKnots() || general.hasUniformKnots())
+        {
+            cout << "Test failed - uniform knots not detected correctly!" << endl;
+            return;
+        }
+
+        unsigned int m = degree + 1;
+        std::vector<double> values(3*m), derivatives(3*m), expected(3*m);
+
+        for (auto x : linspace(-1, 2, 300))
+        {
+            int u = uniform.evaluateNonZeroDerivatives(x, 2, derivatives.data(), m);
+            int v = general.evaluateNonZeroDerivatives(x, 2, expected.data(), m);
+            uniform.evaluateNonZero(x, values.data());
+
+            if (u != v || u != uniform.indexHalfopenInterval(std::min(x, std::nextafter(2.0, 0.0))))
             {
-                // Forward diff
-                DenseVector dx2f = x; dx2f(1) = x(1)+h;
-                DenseVector dx2b = x;
-                x1_diff = (spline.eval(dx2f) - spline.eval(dx2b))/h;
+                cout << "Test failed - wrong knot interval at " << x << endl;
+                return;
             }
-            else
+
+            for (unsigned int i = 0; i < 3*m; i++)
             {
-                // Central diff
-                DenseVector dx2f = x; dx2f(1) = x(1)+h/2;
-                DenseVector dx2b = x; dx2b(1) = x(1)-h/2;
-                x1_diff = (spline.eval(dx2f) - spline.eval(dx2b))/h;
+                bool valuesOk = i >= m || std::abs(values.at(i) - expected.at(i)) < 1e-6;
+                if (!valuesOk || std::abs(derivatives.at(i) - expected.at(i)) > 1e-6*(1 + std::abs(expected.at(i))))
+                {
+                    cout << "Test failed - uniform basis of degree " << degree << " differs at " << x << endl;
+                    return;
+                }
             }
+        }
+    }
 
-            if (std::abs(dfdx(0) - x0_diff) > tol
-                || std::abs(dfdx(1) - x1_diff) > tol)
+    cout << "Test finished successfully!" << endl;
+}
+
+/*
+ * The piecewise polynomial form of a B-spline must agree with the B-spline,
+ * also for the derivatives and for different degrees in each variable.
+ */
+void testPiecewisePolynomial()
+{
+    cout << endl << endl;
+    cout << "Testing piecewise polynomial form..." << endl;
+
+    DataTable samples;
+    DenseVector x(2);
+
+    for (auto x0 : linspace(-1, 1, 9))
+    {
+        for (auto x1 : linspace(0, 2, 11))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, sixHumpCamelBack(x));
+        }
+    }
+
+    BSpline linear(samples, BSplineType::LINEAR);
+    BSpline cubic(samples, BSplineType::CUBIC);
+
+    // Mixed degrees and non-uniform knots
+    std::vector<double> coefficients;
+    for (unsigned int i = 0; i < 6*5; i++)
+        coefficients.push_back(std::cos(i));
+    std::vector< std::vector<double> > knots = {{-1, -1, -1, -0.7, 0, 0.2, 1, 1, 1},
+                                                {0, 0, 0, 0, 0.5, 2, 2, 2, 2}};
+    BSpline mixed(coefficients, knots, {2, 3});
+
+    for (auto bspline : {&linear, &cubic, &mixed})
+    {
+        PiecewisePolynomial pp(*bspline);
+
+        for (auto x0 : linspace(-1, 1, 23))
+        {
+            for (auto x1 : linspace(0, 2, 19))
             {
-                cout << x0 << ", " << x1 << endl;
-                cout << dfdx(0) - x0_diff << endl;
-                cout << dfdx(1) - x1_diff << endl;
-                cout << "Test failed - check Jacobian!" << endl;
-                return;
+                x(0) = x0;
+                x(1) = x1;
+
+                double error = std::abs(pp.eval(x) - bspline->eval(x));
+                double errorJacobian = (pp.evalJacobian(x) - bspline->evalJacobian(x)).cwiseAbs().maxCoeff();
+                double errorHessian = (pp.evalHessian(x) - bspline->evalHessian(x)).cwiseAbs().maxCoeff();
+
+                if (error > 1e-10 || errorJacobian > 1e-8 || errorHessian > 1e-6)
+                {
+                    cout << "Test failed - piecewise polynomial differs at " << x.transpose() << endl;
+                    return;
+                }
             }
         }
     }
@@ -499,8 +1842,40 @@ void run_tests()
 
     testSplineDerivative();
 
+    testPolynomialReproduction();
+
+    testGridInterpolation();
+
+    testPSplineKronecker();
+
+    testPSplineGCV();
+
+    testFitter();
+
+    testConjugateGradient();
+
+    testPSplineScattered();
+
+    testMultilevelApproximation();
+
+    testKnotRefinement();
+
+    testBatchEvaluation();
+
+    testUniformKnots();
+
+    testPiecewisePolynomial();
+
     runRecursiveDomainReductionTest();
 
+    testBSplineView();
+
+    testBSplineBounds();
+
+    testRadialBasisFunctionSolvers();
+
+    testKdTree();
+
     hessianTest();
 }
 
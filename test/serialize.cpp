@@ -10,6 +10,7 @@
 #include <datatable.h>
 #include <datasample.h>
 #include <serialize.h>
+#include <piecewisepolynomial.h>
 #include "testingutilities.h"
 #include <iostream>
 
@@ -210,6 +211,43 @@ bool serializeBSpline1()
     return compareBSplines(bspline, loadedBspline);
 }
 
+bool serializePiecewisePolynomial1()
+{
+    DataTable samples;
+    DenseVector x(2);
+    for (auto x0 : linspace(0, 2, 10))
+    {
+        for (auto x1 : linspace(0, 2, 8))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            samples.addSample(x, sixHumpCamelBack(x));
+        }
+    }
+
+    PiecewisePolynomial polynomial(BSpline(samples, BSplineType::CUBIC));
+    polynomial.save("saveTest1.piecewisepolynomial");
+    PiecewisePolynomial loadedPolynomial("saveTest1.piecewisepolynomial");
+    remove("saveTest1.piecewisepolynomial");
+
+    if (loadedPolynomial.getNumVariables() != 2 || loadedPolynomial.getNumCells() != polynomial.getNumCells())
+        return false;
+
+    for (auto x0 : linspace(0, 2, 23))
+    {
+        for (auto x1 : linspace(0, 2, 17))
+        {
+            x(0) = x0;
+            x(1) = x1;
+            if (polynomial.eval(x) != loadedPolynomial.eval(x)
+                || polynomial.evalJacobian(x) != loadedPolynomial.evalJacobian(x))
+                return false;
+        }
+    }
+
+    return true;
+}
+
 int main()
 {
     cout << endl << endl;
@@ -224,6 +262,8 @@ int main()
     cout << "serializeDataTable6(): " << (serializeDataTable6() ? "success" : "fail")   << endl;
     cout << "BSplines:                                                              "   << endl;
     cout << "serializeBSpline1():   " << (serializeBSpline1()   ? "success" : "fail")   << endl;
+    cout << "PiecewisePolynomials:                                                  "   << endl;
+    cout << "serializePiecewisePolynomial1(): " << (serializePiecewisePolynomial1() ? "success" : "fail") << endl;
 
     return 0;
 }